@@ -7,6 +7,7 @@
 #include <utility>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
 #include <boost/system/detail/error_code.hpp>
 
 #include <spdlog/common.h>
@@ -18,6 +19,7 @@
 #include "mstack/netns.hpp"
 #include "mstack/socket.hpp"
 #include "mstack/tcp.hpp"
+#include "mstack/trace.hpp"
 #include "mstack/write.hpp"
 
 namespace {
@@ -25,6 +27,7 @@ namespace {
 using namespace std::string_view_literals;
 
 constexpr auto kBindIPv4AddrDefault{"192.168.0.1"sv};
+constexpr auto kTraceDumpPath{"mstack.trace"sv};
 
 void async_read_and_echo(std::shared_ptr<mstack::socket>              sk,
                          std::shared_ptr<std::array<std::byte, 2000>> buf) {
@@ -66,6 +69,21 @@ void do_accept(std::shared_ptr<mstack::acceptor> acceptor) {
         });
 }
 
+#ifdef MSTACK_TRACE
+void dump_trace_on_signal(boost::asio::signal_set& signals) {
+        signals.async_wait([&signals](boost::system::error_code const& ec, int) {
+                if (ec) return;
+                try {
+                        mstack::trace::dump(kTraceDumpPath);
+                        spdlog::info("[TRACE] DUMPED TO {}", kTraceDumpPath);
+                } catch (std::exception const& e) {
+                        spdlog::warn("{}", e.what());
+                }
+                dump_trace_on_signal(signals);
+        });
+}
+#endif
+
 }  // namespace
 
 int main(int argc, char const* argv[]) {
@@ -106,6 +124,11 @@ int main(int argc, char const* argv[]) {
                 .dev  = dev,
         });
 
+#ifdef MSTACK_TRACE
+        boost::asio::signal_set trace_signals{netns.io_context_execution(), SIGUSR1};
+        dump_trace_on_signal(trace_signals);
+#endif
+
         netns.io_context_execution().run();
 
         return EXIT_SUCCESS;
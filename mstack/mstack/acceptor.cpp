@@ -5,6 +5,7 @@
 #include <memory>
 #include <utility>
 
+#include <boost/asio/error.hpp>
 #include <boost/system/error_code.hpp>
 
 #include <spdlog/spdlog.h>
@@ -23,46 +24,82 @@ acceptor::acceptor(
         net_.tcb_m().rule_insert_back(
                 matcher, [this](boost::system::error_code const& ec, endpoint const& remote_ep,
                                 endpoint const& local_ep, std::weak_ptr<tcb_t> tcb) {
-                        if (ec) {
-                                spdlog::critical("failed to accept a new connection, reason: {}",
-                                                 ec.what());
-                                return;
-                        }
-                        if (!cbs_.empty()) {
-                                auto cb{cbs_.front()};
-                                cbs_.pop();
-                                cb(remote_ep, local_ep, std::move(tcb));
-                        }
+                        on_connection(ec, remote_ep, local_ep, std::move(tcb));
                 });
 }
 
+acceptor::acceptor(netns& net, endpoint const& local_ep, reuseport_balance balance)
+    : net_(net),
+      listener_id_(net_.tcb_m().listen_reuseport(
+              local_ep, balance,
+              {
+                      .cb   = [this](boost::system::error_code const& ec, endpoint const& remote_ep,
+                               endpoint const& local_ep, std::weak_ptr<tcb_t> tcb) {
+                              on_connection(ec, remote_ep, local_ep, std::move(tcb));
+                      },
+                      .idle = [this] { return cbs_.size(); },
+              })) {}
+
 acceptor::acceptor(netns& net, endpoint const& local_ep)
     : acceptor(net,
                [local_ep_exp = local_ep](endpoint const& remote_ep [[maybe_unused]],
                                          endpoint const& local_ep) {
-                       return (0 == local_ep_exp.addrv4.raw() ||
-                               (0 != local_ep_exp.addrv4.raw() &&
-                                local_ep_exp.addrv4 == local_ep.addrv4)) &&
-                              (0 == local_ep_exp.addrv4_port ||
-                               (0 != local_ep_exp.addrv4_port &&
-                                local_ep_exp.addrv4_port == local_ep.addrv4_port));
+                       return local_ep_exp.covers(local_ep);
                }) {}
 
 acceptor::acceptor(endpoint const& local_ep) : acceptor(netns::_default_(), local_ep) {}
 
-acceptor::~acceptor() = default;
+acceptor::~acceptor() {
+        if (0 != listener_id_) net_.tcb_m().unlisten(listener_id_);
+}
 
 netns& acceptor::net() { return net_; }
 netns& acceptor::net() const { return net_; }
 
+void acceptor::on_connection(boost::system::error_code const& ec,
+                             endpoint const&                  remote_ep,
+                             endpoint const&                  local_ep,
+                             std::weak_ptr<tcb_t>             tcb) {
+        if (ec) {
+                spdlog::critical("failed to accept a new connection, reason: {}", ec.what());
+                return;
+        }
+        if (!cbs_.empty()) {
+                auto cb{cbs_.front()};
+                cbs_.pop();
+                cb(remote_ep, local_ep, std::move(tcb));
+        } else if (backlog_.size() < kBacklog) {
+                backlog_.push({remote_ep, local_ep, std::move(tcb)});
+        } else if (auto sp{tcb.lock()}) {
+                spdlog::warn("[ACCEPTOR] BACKLOG FULL, RESET {} <-> {}", local_ep, remote_ep);
+                sp->abort(boost::asio::error::connection_refused);
+        }
+}
+
 void acceptor::async_accept(socket& sk, std::function<void(boost::system::error_code const&)> cb) {
-        cbs_.push([&sk, cb = std::move(cb)](endpoint const& remote_ep [[maybe_unused]],
-                                            endpoint const& local_ep, std::weak_ptr<tcb_t> tcb) {
+        auto accept{[&sk, cb = std::move(cb)](endpoint const& remote_ep [[maybe_unused]],
+                                              endpoint const& local_ep, std::weak_ptr<tcb_t> tcb) {
                 sk.local_ep = local_ep;
                 sk.state    = kSocketConnected;
                 sk.tcb      = std::move(tcb);
                 cb({});
-        });
+        }};
+
+        // those gone while they waited are left out
+        while (!backlog_.empty() && backlog_.front().tcb.expired())
+                backlog_.pop();
+
+        if (backlog_.empty()) {
+                cbs_.push(std::move(accept));
+                return;
+        }
+
+        // completes later all the same, as when it has to wait
+        net_.tcb_m().io_context().post(
+                [accept = std::move(accept), p = std::move(backlog_.front())] {
+                        accept(p.remote_ep, p.local_ep, p.tcb);
+                });
+        backlog_.pop();
 }
 
 }  // namespace mstack
@@ -3,11 +3,16 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/system/error_code.hpp>
 
+#include <cstddef>
+#include <cstdint>
+
 #include <functional>
+#include <memory>
 #include <queue>
 
 #include "endpoint.hpp"
 #include "netns.hpp"
+#include "tcb_manager.hpp"
 
 namespace mstack {
 
@@ -15,10 +20,22 @@ class socket;
 
 class acceptor {
 public:
+        // established connections kept for accepts to come, as with SOMAXCONN
+        static constexpr size_t kBacklog{128};
+
         explicit acceptor(netns&                                               net,
                           std::function<bool(endpoint const& remote_ep,
                                              endpoint const& local_ep)> const& matcher);
         explicit acceptor(netns& net, endpoint const& local_ep);
+
+        /**
+         *  One of several acceptors sharing @local_ep (SO_REUSEPORT), each new
+         *  connection goes to one of them picked as @balance says, or to the
+         *  next with an accept waiting if that one has none. Give each
+         *  worker its own, on the netns of its thread for a netns_group: then
+         *  every shard accepts the connections it owns, on its own thread.
+         */
+        explicit acceptor(netns& net, endpoint const& local_ep, reuseport_balance balance);
         explicit acceptor(endpoint const& local_ep);
         ~acceptor();
 
@@ -34,9 +51,23 @@ public:
         netns& net() const;
 
 private:
-        netns& net_;
+        void on_connection(boost::system::error_code const& ec,
+                           endpoint const&                  remote_ep,
+                           endpoint const&                  local_ep,
+                           std::weak_ptr<tcb_t>             tcb);
+
+        netns&   net_;
+        uint64_t listener_id_{0};
         std::queue<std::function<void(endpoint const&, endpoint const&, std::weak_ptr<tcb_t>)>>
                 cbs_;
+
+        struct pending {
+                endpoint             remote_ep;
+                endpoint             local_ep;
+                std::weak_ptr<tcb_t> tcb;
+        };
+        // established before they were asked for
+        std::queue<pending> backlog_;
 };
 
 }  // namespace mstack
@@ -16,9 +16,12 @@ std::byte operator""_b(unsigned long long x) { return static_cast<std::byte>(x);
 
 namespace mstack {
 
-arp::arp(boost::asio::io_context& io_ctx, std::shared_ptr<neigh_cache> arp_cache)
-    : base_protocol(io_ctx), arp_cache_(std::move(arp_cache)) {
+arp::arp(boost::asio::io_context&     io_ctx,
+         std::shared_ptr<neigh_cache> arp_cache,
+         std::shared_ptr<skb_pool>    pool)
+    : base_protocol(io_ctx), arp_cache_(std::move(arp_cache)), pool_(std::move(pool)) {
         assert(arp_cache_);
+        assert(pool_);
 }
 
 void arp::async_resolve(mac_addr_t const&                          from_mac,
@@ -37,10 +40,26 @@ void arp::async_resolve(mac_addr_t const&                          from_mac,
 void arp::update(std::pair<mac_addr_t, ipv4_addr_t> const& peer) {
         if (!(peer.first.is_broadcast() || peer.first.is_zero())) {
                 spdlog::debug("[ARP] UPDATE CACHE {} -> {}", peer.first, peer.second);
+                auto const known{arp_cache_->query(peer.second).has_value()};
                 arp_cache_->update({peer.second, peer.first});
+                if (!known && on_learn_) on_learn_(peer.first, peer.second);
         }
 }
 
+void arp::learn(mac_addr_t const& mac, ipv4_addr_t const& ipv4) {
+        spdlog::debug("[ARP] LEARN {} -> {}", mac, ipv4);
+        arp_cache_->update({ipv4, mac});
+        if (auto it{on_replies_.find(ipv4)}; on_replies_.end() != it) {
+                auto on_reply{std::move(it->second)};
+                on_replies_.erase(it);
+                on_reply(mac);
+        }
+}
+
+void arp::on_learn(std::function<void(mac_addr_t const& mac, ipv4_addr_t const& ipv4)> fn) {
+        on_learn_ = std::move(fn);
+}
+
 void arp::async_reply(std::pair<mac_addr_t, ipv4_addr_t> const& from,
                       std::pair<mac_addr_t, ipv4_addr_t> const& to,
                       ethernetv2_frame&&                        in_frame) {
@@ -96,11 +115,7 @@ void arp::async_request(std::pair<mac_addr_t, ipv4_addr_t> const& from,
 
         auto const room{ethernetv2_header_t::size() + arpv4_header_t::size()};
 
-        auto skb_out = skbuff{
-                std::make_unique_for_overwrite<std::byte[]>(room),
-                room,
-                ethernetv2_header_t::size(),
-        };
+        auto skb_out = skbuff{*pool_, room, ethernetv2_header_t::size()};
 
         out_arp.produce_to_net(skb_out.head());
 
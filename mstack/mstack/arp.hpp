@@ -14,14 +14,17 @@
 #include "ipv4_addr.hpp"
 #include "mac_addr.hpp"
 #include "neigh_cache.hpp"
+#include "skb_pool.hpp"
 
 namespace mstack {
 
-class arp : public base_protocol<ethernetv2_frame, void> {
+class arp final : public base_protocol<ethernetv2_frame, void> {
 public:
         static constexpr uint16_t PROTO{0x0806};
 
-        explicit arp(boost::asio::io_context& io_ctx, std::shared_ptr<neigh_cache> arp_cache);
+        explicit arp(boost::asio::io_context&     io_ctx,
+                     std::shared_ptr<neigh_cache> arp_cache,
+                     std::shared_ptr<skb_pool>    pool);
         ~arp() = default;
 
         arp(arp const&)            = delete;
@@ -36,6 +39,18 @@ public:
                            std::shared_ptr<device>                    dev,
                            std::function<void(mac_addr_t const& mac)> cb);
 
+        /**
+         *  A neighbour learnt elsewhere, another shard of a netns_group: it is
+         *  cached and what waits for it resolved as if its reply came in here
+         */
+        void learn(mac_addr_t const& mac, ipv4_addr_t const& ipv4);
+
+        /**
+         *  Called with every neighbour this one learns from the wire and had
+         *  not cached yet
+         */
+        void on_learn(std::function<void(mac_addr_t const& mac, ipv4_addr_t const& ipv4)> fn);
+
 private:
         void update(std::pair<mac_addr_t, ipv4_addr_t> const& peer);
         void async_reply(std::pair<mac_addr_t, ipv4_addr_t> const& from,
@@ -49,8 +64,10 @@ private:
         void process(ethernetv2_frame&& in_frame) override;
 
         std::shared_ptr<neigh_cache> arp_cache_;
+        std::shared_ptr<skb_pool>    pool_;
         std::unordered_map<ipv4_addr_t, boost::signals2::signal<void(mac_addr_t const& mac)>>
                 on_replies_;
+        std::function<void(mac_addr_t const& mac, ipv4_addr_t const& ipv4)> on_learn_;
 };
 
 }  // namespace mstack
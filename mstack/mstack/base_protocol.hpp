@@ -2,47 +2,286 @@
 
 #include <cassert>
 
+#include <algorithm>
 #include <concepts>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <optional>
-#include <queue>
+#include <span>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include "queue_limit.hpp"
 #include "skbuff.hpp"
+#include "trace.hpp"
 
 namespace mstack {
 
 class device;
 
-template <typename UnderPacketType, typename UpperPacketType>
+/**
+ *  Upper protocol @Proto taking the packets whose proto field is @Id, named in
+ *  the template arguments of base_protocol to be wired in at compile time
+ */
+template <int Id, typename Proto>
+struct upper_proto {
+        static constexpr int id{Id};
+        using type = Proto;
+};
+
+namespace detail {
+
+inline void prefetch(skbuff const& skb) { __builtin_prefetch(skb.head()); }
+
+template <typename PacketType>
+void prefetch(PacketType const& pkt) {
+        prefetch(pkt.skb);
+}
+
+template <typename T>
+void prefetch(std::pair<skbuff, T> const& pkt) {
+        prefetch(pkt.first);
+}
+
+/**
+ *  The protocols a layer hands its packets up to. Those named by @UpperProtos
+ *  are reached with a compare on the proto field and a direct call the compiler
+ *  can inline, any other is looked up in a map filled at runtime, which is the
+ *  slow path. The upper protocol types only need to be complete where packets
+ *  are dispatched, a translation unit feeding packets to a layer has to
+ *  include the headers of the layers above it.
+ */
+template <typename PacketType, typename... UpperProtos>
+class upper_protos {
+public:
+        template <typename UpperProto>
+        void update(int id, UpperProto& proto) {
+                if (bind(id, proto, std::index_sequence_for<UpperProtos...>{})) return;
+
+                dynamic_[id] = [&proto](PacketType&& pkt_in) { proto.receive(std::move(pkt_in)); };
+        }
+
+        /**
+         *  false if no protocol takes @pkt_in, it is left untouched then
+         */
+        bool dispatch(PacketType& pkt_in) {
+                if (dispatch_static(pkt_in, std::index_sequence_for<UpperProtos...>{}))
+                        return true;
+
+                if (auto prot_it{dynamic_.find(pkt_in.proto)}; dynamic_.end() != prot_it) {
+                        prot_it->second(std::move(pkt_in));
+                        return true;
+                }
+                return false;
+        }
+
+        /**
+         *  Hands the packets at the front of @pkts_in sharing a proto field up
+         *  in one go when a protocol wired in at compile time takes them,
+         *  returns how many that was, 0 leaves the front to dispatch() above
+         */
+        size_t dispatch(std::span<PacketType> pkts_in) {
+                assert(!pkts_in.empty());
+
+                auto const proto{pkts_in.front().proto};
+                auto const run{static_cast<size_t>(
+                        std::ranges::find_if(pkts_in,
+                                             [proto](auto const& pkt) {
+                                                     return pkt.proto != proto;
+                                             }) -
+                        pkts_in.begin())};
+
+                auto const idx{std::index_sequence_for<UpperProtos...>{}};
+                return dispatch_static(pkts_in.first(run), idx) ? run : 0;
+        }
+
+private:
+        template <typename UpperProto, size_t... I>
+        bool bind(int id, UpperProto& proto, std::index_sequence<I...>) {
+                return (bind_at<I>(id, proto) || ...);
+        }
+
+        template <size_t I, typename UpperProto>
+        bool bind_at(int id, UpperProto& proto) {
+                using entry = std::tuple_element_t<I, std::tuple<UpperProtos...>>;
+                if constexpr (std::same_as<UpperProto, typename entry::type>) {
+                        if (entry::id != id) return false;
+                        std::get<I>(static_) = &proto;
+                        return true;
+                } else {
+                        return false;
+                }
+        }
+
+        template <size_t... I>
+        bool dispatch_static(PacketType& pkt_in, std::index_sequence<I...>) {
+                return ((UpperProtos::id == pkt_in.proto && deliver<I>(pkt_in)) || ...);
+        }
+
+        template <size_t... I>
+        bool dispatch_static(std::span<PacketType> pkts_in, std::index_sequence<I...>) {
+                return ((UpperProtos::id == pkts_in.front().proto && deliver<I>(pkts_in)) || ...);
+        }
+
+        template <size_t I, typename In>
+        bool deliver(In&& in) {
+                auto* const proto{std::get<I>(static_)};
+                if (!proto) return false;
+                proto->receive(std::move(in));
+                return true;
+        }
+
+        std::tuple<typename UpperProtos::type*...>                 static_{};
+        std::unordered_map<int, std::function<void(PacketType&&)>> dynamic_;
+};
+
+/**
+ *  The protocol a layer hands its packets down to, plain function pointers
+ *  rather than a std::function
+ */
+template <typename PacketType>
+class under_proto {
+public:
+        template <typename UnderProtocol>
+        void update(UnderProtocol& proto) {
+                proto_   = &proto;
+                receive_ = [](void* p, PacketType&& pkt) {
+                        static_cast<UnderProtocol*>(p)->receive(std::move(pkt));
+                };
+                flush_ = [](void* p) { static_cast<UnderProtocol*>(p)->flush(); };
+        }
+
+        explicit operator bool() const { return receive_; }
+
+        void operator()(PacketType&& pkt) const { receive_(proto_, std::move(pkt)); }
+
+        void flush() const { flush_(proto_); }
+
+private:
+        void* proto_{nullptr};
+        void (*receive_)(void*, PacketType&&){nullptr};
+        void (*flush_)(void*){nullptr};
+};
+
+/**
+ *  Packets on their way down to the protocol below. They are handed over in
+ *  batches: the first packet of a batch posts a single flush to the
+ *  io_context, and a flush takes the whole batch through the layer below and
+ *  has that layer flush right away in turn, so the batch reaches the device in
+ *  one run. A layer flushed from above finds its own posted flush with nothing
+ *  left to do. No more than the limit depth packets wait at a time.
+ */
+template <typename PacketType>
+class tx_batch {
+public:
+        /**
+         *  false if a packet had to be dropped, @pkt or the oldest one
+         *  depending on the drop policy
+         */
+        template <typename Handler>
+        bool push(boost::asio::io_context& io_ctx, PacketType&& pkt, Handler&& flush) {
+                bool dropped{false};
+                if (!(size() < limit_.depth)) {
+                        ++stats_.drops;
+                        if (drop_policy::tail == limit_.policy || 0 == limit_.depth) return false;
+                        drop_head();
+                        dropped = true;
+                }
+
+                pending_.push_back(std::move(pkt));
+                stats_.depth_max = std::max<uint64_t>(stats_.depth_max, size());
+
+                if (!flush_posted_) {
+                        flush_posted_ = true;
+                        io_ctx.post([this, flush = std::forward<Handler>(flush)] {
+                                flush_posted_ = false;
+                                flush();
+                        });
+                }
+                return !dropped;
+        }
+
+        /**
+         *  Calls @fn on each packet queued so far, packets queued meanwhile wait
+         *  for the next flush. false if there was none.
+         */
+        template <typename Fn>
+        bool drain(Fn&& fn) {
+                if (0 == size()) return false;
+
+                // taken out for the time being, packets queued meanwhile go to
+                // the spare vector
+                auto batch{std::exchange(pending_, std::move(spare_))};
+                auto first{std::exchange(first_, 0)};
+                for (auto i{first}; i < batch.size(); ++i) {
+                        if (i + 1 < batch.size()) prefetch(batch[i + 1]);
+                        fn(std::move(batch[i]));
+                }
+                batch.clear();
+                spare_ = std::move(batch);
+                return true;
+        }
+
+        size_t size() const { return pending_.size() - first_; }
+
+        bool full() const { return !(size() < limit_.depth); }
+
+        queue_limit const& limit() const { return limit_; }
+        void               set_limit(queue_limit limit) { limit_ = limit; }
+
+        queue_stats const& stats() const { return stats_; }
+
+private:
+        // the oldest packet goes, its slot is reclaimed once half of them are
+        // dead
+        void drop_head() {
+                pending_[first_++] = PacketType{};
+                if (first_ > pending_.size() / 2) {
+                        pending_.erase(pending_.begin(),
+                                       pending_.begin() + static_cast<ptrdiff_t>(first_));
+                        first_ = 0;
+                }
+        }
+
+        std::vector<PacketType> pending_;
+        std::vector<PacketType> spare_;
+        size_t                  first_{0};
+        bool                    flush_posted_{false};
+        queue_limit             limit_{};
+        queue_stats             stats_{};
+};
+
+}  // namespace detail
+
+template <typename UnderPacketType, typename UpperPacketType, typename... UpperProtos>
 class base_protocol {
 protected:
         boost::asio::io_context&               io_ctx_;
         std::function<void(UpperPacketType&&)> unknown_upper_proto_handler_;
 
 private:
-        std::unordered_map<int, std::function<void(UpperPacketType&&)>> upper_protos_;
+        detail::upper_protos<UpperPacketType, UpperProtos...> upper_protos_;
+        std::vector<UpperPacketType>                          rx_batch_;
 
-        std::function<void(UnderPacketType)> under_proto_;
-        std::queue<UnderPacketType>          packet_queue_;
+        detail::under_proto<UnderPacketType> under_proto_;
+        detail::tx_batch<UnderPacketType>    tx_batch_;
 
 public:
         template <std::convertible_to<int> Index, typename UpperProto>
         void upper_proto_update(Index id, UpperProto& proto) {
-                upper_protos_[id] = [&proto](UpperPacketType&& pkt_in) {
-                        proto.receive(std::move(pkt_in));
-                };
+                upper_protos_.update(static_cast<int>(id), proto);
         }
 
         template <typename UnderProtocol>
         void under_proto_update(UnderProtocol& proto) {
-                under_proto_ = [&proto](UnderPacketType&& pkt) { proto.receive(std::move(pkt)); };
+                under_proto_.update(proto);
         }
 
         void receive(UpperPacketType&& in) { process(std::move(in)); }
@@ -51,6 +290,45 @@ public:
                 if (auto out{make_packet(std::move(in))}) dispatch(std::move(*out));
         }
 
+        /**
+         *  Takes the whole batch through this layer before handing it up
+         */
+        void receive(std::span<UnderPacketType> in) {
+                // taken out for the time being, should a layer above ever feed
+                // a batch back to this one
+                auto batch{std::move(rx_batch_)};
+                for (size_t i{0}; i < in.size(); ++i) {
+                        if (i + 1 < in.size()) detail::prefetch(in[i + 1]);
+                        if (auto out{make_packet(std::move(in[i]))})
+                                batch.push_back(std::move(*out));
+                }
+
+                dispatch(batch);
+                batch.clear();
+                rx_batch_ = std::move(batch);
+        }
+
+        /**
+         *  Hands what has been queued for the layer below down now
+         */
+        void flush() {
+                if (!under_proto_) return;
+
+                auto const down{[this](UnderPacketType&& pkt) { under_proto_(std::move(pkt)); }};
+                if (tx_batch_.drain(down)) under_proto_.flush();
+        }
+
+        /**
+         *  Depth and drop policy of the queue of packets waiting for the layer
+         *  below
+         */
+        queue_limit const& tx_limit() const { return tx_batch_.limit(); }
+        void               set_tx_limit(queue_limit limit) { tx_batch_.set_limit(limit); }
+
+        queue_stats const& tx_stats() const { return tx_batch_.stats(); }
+
+        bool tx_full() const { return tx_batch_.full(); }
+
         template <typename Callback>
         void set_unknown_upper_proto_cb(Callback&& cb) {
                 unknown_upper_proto_handler_ = std::forward<Callback>(cb);
@@ -67,13 +345,7 @@ protected:
         base_protocol& operator=(base_protocol&&) = delete;
 
         void enqueue(UnderPacketType&& pkt) {
-                packet_queue_.push(std::move(pkt));
-                io_ctx_.post([this] {
-                        if (under_proto_) {
-                                under_proto_(std::move(packet_queue_.front()));
-                                packet_queue_.pop();
-                        }
-                });
+                tx_batch_.push(io_ctx_, std::move(pkt), [this] { flush(); });
         }
 
         virtual void process(UpperPacketType&& pkt_in [[maybe_unused]]) = 0;
@@ -89,37 +361,42 @@ protected:
 
 private:
         void dispatch(UpperPacketType&& pkt_in) {
-                if (auto prot_it{upper_protos_.find(pkt_in.proto)};
-                    upper_protos_.end() != prot_it) {
-                        spdlog::debug("[PROCESS PACKET] PROTO {:#04X}", pkt_in.proto);
-                        prot_it->second(std::move(pkt_in));
-                } else if (unknown_upper_proto_handler_) {
-                        spdlog::debug("[UNKNOWN PACKET] PROTO {:#04X}, HANDLED", pkt_in.proto);
-                        unknown_upper_proto_handler_(std::move(pkt_in));
-                } else {
-                        spdlog::debug("[UNKNOWN PACKET] PROTO {:#04X}, UNHANDLED", pkt_in.proto);
+                if (upper_protos_.dispatch(pkt_in)) return;
+                MSTACK_TRACE_EVENT(proto_unknown, pkt_in.proto);
+                if (unknown_upper_proto_handler_) unknown_upper_proto_handler_(std::move(pkt_in));
+        }
+
+        void dispatch(std::span<UpperPacketType> pkts_in) {
+                while (!pkts_in.empty()) {
+                        if (auto const n{upper_protos_.dispatch(pkts_in)}; n > 0) {
+                                pkts_in = pkts_in.subspan(n);
+                                continue;
+                        }
+                        dispatch(std::move(pkts_in.front()));
+                        pkts_in = pkts_in.subspan(1);
                 }
         }
 };
 
-template <typename UpperPacketType>
-class base_protocol<void, UpperPacketType> {
+template <typename UpperPacketType, typename... UpperProtos>
+class base_protocol<void, UpperPacketType, UpperProtos...> {
 protected:
         boost::asio::io_context&               io_ctx_;
         std::function<void(UpperPacketType&&)> unknown_upper_proto_handler_;
 
 private:
-        std::unordered_map<int, std::function<void(UpperPacketType)>> upper_protos_;
+        using device_skb = std::pair<skbuff, std::shared_ptr<device>>;
+
+        detail::upper_protos<UpperPacketType, UpperProtos...> upper_protos_;
+        std::vector<UpperPacketType>                          rx_batch_;
 
         std::function<void(skbuff&&, std::shared_ptr<device>)> under_proto_;
-        std::queue<std::pair<skbuff, std::shared_ptr<device>>> skb_queue_;
+        detail::tx_batch<device_skb>                           tx_batch_;
 
 public:
         template <std::convertible_to<int> Index, typename UpperProto>
         void upper_proto_update(Index id, UpperProto& proto) {
-                upper_protos_[id] = [&proto](UpperPacketType&& pkt_in) {
-                        proto.receive(std::move(pkt_in));
-                };
+                upper_protos_.update(static_cast<int>(id), proto);
         }
 
         void under_handler_update(std::function<void(skbuff&&, std::shared_ptr<device>)> handler) {
@@ -133,6 +410,43 @@ public:
                         dispatch(std::move(*out));
         }
 
+        /**
+         *  Takes the whole batch through this layer before handing it up
+         */
+        void receive(std::span<skbuff> skbs_in, std::shared_ptr<device> const& dev) {
+                auto batch{std::move(rx_batch_)};
+                for (size_t i{0}; i < skbs_in.size(); ++i) {
+                        if (i + 1 < skbs_in.size()) detail::prefetch(skbs_in[i + 1]);
+                        if (auto out{make_packet(std::move(skbs_in[i]), dev)})
+                                batch.push_back(std::move(*out));
+                }
+
+                dispatch(batch);
+                batch.clear();
+                rx_batch_ = std::move(batch);
+        }
+
+        /**
+         *  Hands what has been queued for the devices to them now
+         */
+        void flush() {
+                if (!under_proto_) return;
+
+                tx_batch_.drain(
+                        [this](device_skb&& out) { std::apply(under_proto_, std::move(out)); });
+        }
+
+        /**
+         *  Depth and drop policy of the queue of packets waiting for the layer
+         *  below
+         */
+        queue_limit const& tx_limit() const { return tx_batch_.limit(); }
+        void               set_tx_limit(queue_limit limit) { tx_batch_.set_limit(limit); }
+
+        queue_stats const& tx_stats() const { return tx_batch_.stats(); }
+
+        bool tx_full() const { return tx_batch_.full(); }
+
         template <typename Callback>
         void set_unknown_upper_proto_cb(Callback&& cb) {
                 unknown_upper_proto_handler_ = std::forward<Callback>(cb);
@@ -149,13 +463,7 @@ protected:
         base_protocol& operator=(base_protocol&&) = delete;
 
         void enqueue(skbuff&& skb_out, std::shared_ptr<device> dev) {
-                skb_queue_.push({std::move(skb_out), std::move(dev)});
-                io_ctx_.post([this] {
-                        if (under_proto_) {
-                                std::apply(under_proto_, std::move(skb_queue_.front()));
-                                skb_queue_.pop();
-                        }
-                });
+                tx_batch_.push(io_ctx_, {std::move(skb_out), std::move(dev)}, [this] { flush(); });
         }
 
         virtual void process(UpperPacketType&& pkt_in [[maybe_unused]]) {}
@@ -168,15 +476,19 @@ protected:
 
 private:
         void dispatch(UpperPacketType&& pkt_in) {
-                if (auto prot_it{upper_protos_.find(pkt_in.proto)};
-                    upper_protos_.end() != prot_it) {
-                        spdlog::debug("[PROCESS PACKET] PROTO {:#04X}", pkt_in.proto);
-                        prot_it->second(std::move(pkt_in));
-                } else if (unknown_upper_proto_handler_) {
-                        spdlog::debug("[UNKNOWN PACKET] PROTO {:#04X}, HANDLED", pkt_in.proto);
-                        unknown_upper_proto_handler_(std::move(pkt_in));
-                } else {
-                        spdlog::debug("[UNKNOWN PACKET] PROTO {:#04X}, UNHANDLED", pkt_in.proto);
+                if (upper_protos_.dispatch(pkt_in)) return;
+                MSTACK_TRACE_EVENT(proto_unknown, pkt_in.proto);
+                if (unknown_upper_proto_handler_) unknown_upper_proto_handler_(std::move(pkt_in));
+        }
+
+        void dispatch(std::span<UpperPacketType> pkts_in) {
+                while (!pkts_in.empty()) {
+                        if (auto const n{upper_protos_.dispatch(pkts_in)}; n > 0) {
+                                pkts_in = pkts_in.subspan(n);
+                                continue;
+                        }
+                        dispatch(std::move(pkts_in.front()));
+                        pkts_in = pkts_in.subspan(1);
                 }
         }
 };
@@ -188,17 +500,45 @@ protected:
         std::function<void(UnderPacketType&&)> unknown_proto_handler_;
 
 private:
-        std::function<void(UnderPacketType&&)> under_proto_;
-        std::queue<UnderPacketType>            packet_queue_;
+        detail::under_proto<UnderPacketType> under_proto_;
+        detail::tx_batch<UnderPacketType>    tx_batch_;
 
 public:
         template <typename UnderProtocol>
         void under_proto_update(UnderProtocol& proto) {
-                under_proto_ = [&proto](UnderPacketType&& pkt) { proto.receive(std::move(pkt)); };
+                under_proto_.update(proto);
         }
 
         void receive(UnderPacketType&& in) { process(std::move(in)); }
 
+        void receive(std::span<UnderPacketType> in) {
+                for (size_t i{0}; i < in.size(); ++i) {
+                        if (i + 1 < in.size()) detail::prefetch(in[i + 1]);
+                        process(std::move(in[i]));
+                }
+        }
+
+        /**
+         *  Hands what has been queued for the layer below down now
+         */
+        void flush() {
+                if (!under_proto_) return;
+
+                auto const down{[this](UnderPacketType&& pkt) { under_proto_(std::move(pkt)); }};
+                if (tx_batch_.drain(down)) under_proto_.flush();
+        }
+
+        /**
+         *  Depth and drop policy of the queue of packets waiting for the layer
+         *  below
+         */
+        queue_limit const& tx_limit() const { return tx_batch_.limit(); }
+        void               set_tx_limit(queue_limit limit) { tx_batch_.set_limit(limit); }
+
+        queue_stats const& tx_stats() const { return tx_batch_.stats(); }
+
+        bool tx_full() const { return tx_batch_.full(); }
+
         template <typename Callback>
         void set_unknown_proto_cb(Callback&& cb) {
                 unknown_proto_handler_ = std::forward<Callback>(cb);
@@ -215,13 +555,7 @@ protected:
         base_protocol& operator=(base_protocol&&) = delete;
 
         void enqueue(UnderPacketType&& pkt) {
-                packet_queue_.push(std::move(pkt));
-                io_ctx_.post([this] {
-                        if (under_proto_) {
-                                under_proto_(std::move(packet_queue_.front()));
-                                packet_queue_.pop();
-                        }
-                });
+                tx_batch_.push(io_ctx_, std::move(pkt), [this] { flush(); });
         }
 
         virtual void process(UnderPacketType&& pkt_in [[maybe_unused]]) {}
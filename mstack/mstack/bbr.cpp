@@ -0,0 +1,238 @@
+#include "bbr.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "tcb.hpp"
+
+namespace mstack {
+
+namespace {
+
+double seconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+}
+
+}  // namespace
+
+bbr::bbr() : rand_(std::random_device{}()) {}
+
+std::string const& bbr::name() const {
+        static std::string const kName{"bbr"};
+        return kName;
+}
+
+// the model moves with rate samples only, see on_rate_sample()
+void bbr::on_ack(send& snd [[maybe_unused]], uint32_t acked [[maybe_unused]]) {}
+
+void bbr::on_loss(send& snd) {
+        prior_cwnd_ = in_recovery_ || mode::probe_rtt == mode_
+                              ? std::max(prior_cwnd_, snd.state.cwnd)
+                              : snd.state.cwnd;
+        // no multiplicative decrease, recovery goes on from what is in flight
+        snd.state.ssthresh = std::max<uint32_t>(in_flight(snd), snd.state.mss);
+}
+
+void bbr::on_rto(send& snd) {
+        prior_cwnd_ = std::max(prior_cwnd_, snd.state.cwnd);
+        congestion_control::on_rto(snd);
+}
+
+void bbr::on_rtt_sample(send& snd, clock::duration rtt) {
+        if (!(rtt < min_rtt_)) return;
+
+        min_rtt_       = rtt;
+        min_rtt_stamp_ = clock::now();
+
+        // until the first bandwidth sample, from the handshake RTT
+        if (0 == btl_bw() && rtt > clock::duration::zero())
+                pacing_rate_ = static_cast<uint64_t>(kHighGain * snd.state.cwnd / seconds(rtt));
+}
+
+void bbr::on_rate_sample(send& snd, rate_sample const& rs) {
+        auto const now{clock::now()};
+
+        update_round(rs);
+        update_bw(rs);
+        update_cycle(snd, now);
+        check_full_pipe(rs);
+        check_drain(snd, now);
+        update_min_rtt(snd, rs, now);
+        update_pacing_rate();
+        update_cwnd(snd, rs);
+}
+
+double bbr::btl_bw() const { return std::ranges::max(bw_rounds_); }
+
+double bbr::bdp(send const& snd, double gain) const {
+        if (clock::duration::max() == min_rtt_) return initial_window(snd.state.mss);
+        return gain * btl_bw() * seconds(min_rtt_);
+}
+
+void bbr::update_round(rate_sample const& rs) {
+        round_start_ = false;
+        if (rs.prior_delivered < next_round_delivered_) return;
+
+        next_round_delivered_ = rs.delivered_total;
+        ++round_count_;
+        round_start_ = true;
+        // the slot of the round kBwRounds ago
+        bw_rounds_[round_count_ % kBwRounds] = 0;
+}
+
+void bbr::update_bw(rate_sample const& rs) {
+        // shorter than an RTT, the sample would be a burst rather than a rate
+        if (clock::duration::max() != min_rtt_ && rs.interval < min_rtt_) return;
+
+        auto const bw{rs.delivered / seconds(rs.interval)};
+        // an app limited sample only tells the path does at least as much
+        if (rs.app_limited && bw < btl_bw()) return;
+
+        auto& slot{bw_rounds_[round_count_ % kBwRounds]};
+        slot = std::max(slot, bw);
+}
+
+void bbr::check_full_pipe(rate_sample const& rs) {
+        if (filled_pipe_ || !round_start_ || rs.app_limited) return;
+
+        // still growing by a quarter per round
+        if (!(btl_bw() < bw_full_ * 1.25)) {
+                bw_full_        = btl_bw();
+                bw_full_rounds_ = 0;
+                return;
+        }
+        if (!(++bw_full_rounds_ < 3)) filled_pipe_ = true;
+}
+
+void bbr::check_drain(send const& snd, clock::time_point now) {
+        if (mode::startup == mode_ && filled_pipe_) {
+                mode_        = mode::drain;
+                pacing_gain_ = kDrainGain;
+                cwnd_gain_   = kHighGain;
+        }
+        if (mode::drain == mode_ && !(in_flight(snd) > bdp(snd, 1.0))) enter_probe_bw(now);
+}
+
+void bbr::enter_probe_bw(clock::time_point now) {
+        mode_      = mode::probe_bw;
+        cwnd_gain_ = kCwndGain;
+
+        // any phase but the draining one, flows sharing a bottleneck do not
+        // probe in step then
+        constexpr auto kPhases{kPacingGains.size()};
+        cycle_index_ = (2 + rand_() % (kPhases - 1)) % kPhases;
+        cycle_stamp_ = now;
+        pacing_gain_ = kPacingGains[cycle_index_];
+}
+
+void bbr::update_cycle(send const& snd, clock::time_point now) {
+        if (mode::probe_bw != mode_) return;
+
+        auto const full_length{now - cycle_stamp_ > min_rtt_};
+        auto const flight{in_flight(snd)};
+
+        auto next{full_length};
+        if (pacing_gain_ > 1) {
+                // probing goes on until the queue builds or something is lost
+                next = full_length && (snd.state.in_recovery || !(flight < bdp(snd, pacing_gain_)));
+        } else if (pacing_gain_ < 1) {
+                // draining stops early once the queue is gone
+                next = full_length || !(flight > bdp(snd, 1.0));
+        }
+        if (!next) return;
+
+        cycle_index_ = (cycle_index_ + 1) % kPacingGains.size();
+        cycle_stamp_ = now;
+        pacing_gain_ = kPacingGains[cycle_index_];
+}
+
+void bbr::update_min_rtt(send& snd, rate_sample const& rs, clock::time_point now) {
+        auto const expired{now > min_rtt_stamp_ + kMinRttWindow};
+        if (rs.rtt > clock::duration::zero() && (rs.rtt < min_rtt_ || expired)) {
+                min_rtt_       = rs.rtt;
+                min_rtt_stamp_ = now;
+        }
+
+        if (expired && mode::probe_rtt != mode_) {
+                mode_           = mode::probe_rtt;
+                pacing_gain_    = 1;
+                cwnd_gain_      = 1;
+                prior_cwnd_     = in_recovery_ ? std::max(prior_cwnd_, snd.state.cwnd)
+                                               : snd.state.cwnd;
+                probe_rtt_done_ = {};
+        }
+        if (mode::probe_rtt != mode_) return;
+
+        auto const floor{kMinCwndSegments * snd.state.mss};
+        if (clock::time_point{} == probe_rtt_done_) {
+                // the RTT measured once the queue is gone, for a round and 200 ms
+                if (in_flight(snd) > floor) return;
+                probe_rtt_done_       = now + kProbeRttTime;
+                probe_rtt_round_done_ = false;
+                next_round_delivered_ = rs.delivered_total;
+                return;
+        }
+
+        if (round_start_) probe_rtt_round_done_ = true;
+        if (!probe_rtt_round_done_ || !(now > probe_rtt_done_)) return;
+
+        min_rtt_stamp_ = now;
+        snd.state.cwnd = std::max(snd.state.cwnd, prior_cwnd_);
+        if (filled_pipe_) {
+                enter_probe_bw(now);
+        } else {
+                mode_        = mode::startup;
+                pacing_gain_ = kHighGain;
+                cwnd_gain_   = kHighGain;
+        }
+}
+
+void bbr::update_pacing_rate() {
+        auto const bw{btl_bw()};
+        if (!(bw > 0)) return;
+
+        auto const rate{static_cast<uint64_t>(pacing_gain_ * bw)};
+        // a low sample must not slow startup down before the pipe is full
+        if (filled_pipe_ || rate > pacing_rate_) pacing_rate_ = rate;
+}
+
+void bbr::update_cwnd(send& snd, rate_sample const& rs) {
+        auto& s{snd.state};
+
+        auto const flight{in_flight(snd)};
+        auto const floor{static_cast<uint32_t>(kMinCwndSegments * s.mss)};
+        // and some room for delayed and stretched ACKs
+        auto const target{static_cast<uint32_t>(bdp(snd, cwnd_gain_)) + 3 * s.mss};
+
+        // packet conservation for the first round of recovery, as much goes
+        // out as was delivered, then cwnd is back where it was before
+        if (conserving_ && round_start_) conserving_ = false;
+        if (s.in_recovery && !in_recovery_) {
+                in_recovery_          = true;
+                conserving_           = true;
+                s.cwnd                = flight + rs.acked;
+                next_round_delivered_ = rs.delivered_total;
+        } else if (!s.in_recovery && in_recovery_) {
+                in_recovery_ = false;
+                conserving_  = false;
+                s.cwnd       = std::max(s.cwnd, prior_cwnd_);
+        }
+
+        auto cwnd{s.cwnd};
+        if (conserving_) {
+                cwnd = std::max(cwnd, flight + rs.acked);
+        } else if (filled_pipe_) {
+                cwnd = std::min(cwnd + rs.acked, target);
+        } else if (cwnd < target || rs.delivered_total < initial_window(s.mss)) {
+                // startup, cwnd grows as in slow start
+                cwnd += rs.acked;
+        }
+
+        cwnd = std::max(cwnd, floor);
+        if (mode::probe_rtt == mode_) cwnd = std::min(cwnd, floor);
+        s.cwnd = cwnd;
+}
+
+}  // namespace mstack
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "congestion_control.hpp"
+
+namespace mstack {
+
+/**
+ *  BBR v1: models the path by the bottleneck bandwidth, the highest delivery
+ *  rate of the last ten rounds, and the round trip propagation time, the
+ *  lowest RTT of the last ten seconds. Segments are paced out at the
+ *  bandwidth times a gain which cycles to probe for more and to drain the
+ *  queue that probing builds, and cwnd only caps what is in flight at a small
+ *  multiple of the bandwidth-delay product. Loss does not shrink the model,
+ *  so shallow buffers are neither filled up nor mistaken for congestion.
+ */
+class bbr : public congestion_control {
+public:
+        // 2/ln(2), the lowest gain that doubles the rate every round
+        static constexpr double kHighGain{2.885};
+        static constexpr double kDrainGain{1 / kHighGain};
+        static constexpr double kCwndGain{2.0};
+
+        static constexpr std::array<double, 8> kPacingGains{1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+        static constexpr size_t kBwRounds{10};
+        static constexpr auto   kMinRttWindow{std::chrono::seconds{10}};
+        static constexpr auto   kProbeRttTime{std::chrono::milliseconds{200}};
+        static constexpr size_t kMinCwndSegments{4};
+
+        bbr();
+        ~bbr() override = default;
+
+        std::string const& name() const override;
+
+        void on_ack(send& snd, uint32_t acked) override;
+
+        void on_loss(send& snd) override;
+
+        void on_rto(send& snd) override;
+
+        void on_rtt_sample(send& snd, clock::duration rtt) override;
+
+        void on_rate_sample(send& snd, rate_sample const& rs) override;
+
+        uint64_t pacing_rate() const override { return pacing_rate_; }
+
+private:
+        enum class mode : uint8_t {
+                // doubles the rate every round until the bandwidth stops growing
+                startup,
+                // empties the queue startup left behind
+                drain,
+                // cycles through kPacingGains
+                probe_bw,
+                // keeps little in flight for the RTT to be measured without a queue
+                probe_rtt,
+        };
+
+        /**
+         *  Bottleneck bandwidth, bytes per second
+         */
+        double btl_bw() const;
+
+        /**
+         *  Bytes in flight that keep the pipe full at @gain
+         */
+        double bdp(send const& snd, double gain) const;
+
+        void update_round(rate_sample const& rs);
+        void update_bw(rate_sample const& rs);
+        void check_full_pipe(rate_sample const& rs);
+        void check_drain(send const& snd, clock::time_point now);
+        void update_cycle(send const& snd, clock::time_point now);
+        void update_min_rtt(send& snd, rate_sample const& rs, clock::time_point now);
+        void update_pacing_rate();
+        void update_cwnd(send& snd, rate_sample const& rs);
+
+        void enter_probe_bw(clock::time_point now);
+
+        mode   mode_{mode::startup};
+        double pacing_gain_{kHighGain};
+        double cwnd_gain_{kHighGain};
+
+        // highest rate of each of the last kBwRounds rounds
+        std::array<double, kBwRounds> bw_rounds_{};
+
+        uint64_t round_count_{0};
+        uint64_t next_round_delivered_{0};
+        bool     round_start_{false};
+
+        double bw_full_{0};
+        size_t bw_full_rounds_{0};
+        bool   filled_pipe_{false};
+
+        clock::duration   min_rtt_{clock::duration::max()};
+        clock::time_point min_rtt_stamp_{};
+
+        clock::time_point probe_rtt_done_{};
+        bool              probe_rtt_round_done_{false};
+
+        size_t            cycle_index_{0};
+        clock::time_point cycle_stamp_{};
+
+        // cwnd to go back to after recovery or probe_rtt
+        uint32_t prior_cwnd_{0};
+        bool     in_recovery_{false};
+        // first round of recovery
+        bool conserving_{false};
+
+        uint64_t pacing_rate_{0};
+
+        std::minstd_rand rand_;
+};
+
+}  // namespace mstack
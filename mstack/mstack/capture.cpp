@@ -0,0 +1,196 @@
+#include "capture.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <stdexcept>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace mstack {
+
+namespace {
+
+constexpr uint32_t kPcapngSHB{0x0a0d0d0a};
+constexpr uint32_t kPcapngIDB{1};
+constexpr uint32_t kPcapngEPB{6};
+constexpr uint32_t kPcapngByteOrderMagic{0x1a2b3c4d};
+constexpr uint16_t kPcapngOptEnd{0};
+constexpr uint16_t kPcapngOptIfName{2};
+constexpr uint16_t kPcapngOptIfTsResol{9};
+constexpr uint16_t kPcapngOptEpbFlags{2};
+constexpr uint16_t kLinkTypeEthernet{1};
+// timestamps in nanoseconds
+constexpr uint8_t kTsResolNsec{9};
+
+constexpr size_t pad4(size_t n) { return (n + 3) & ~size_t{3}; }
+
+// pcapng block body built in @buf, in host byte order like the section header
+// says
+class block_body {
+public:
+        explicit block_body(std::vector<std::byte>& buf) : buf_(buf) { buf_.clear(); }
+
+        template <typename T>
+        block_body& put(T const& v) {
+                return put({reinterpret_cast<std::byte const*>(&v), sizeof(v)});
+        }
+
+        block_body& put(std::span<std::byte const> data) {
+                buf_.insert(buf_.end(), data.begin(), data.end());
+                return *this;
+        }
+
+        // fields and option values are padded to 32 bits
+        block_body& pad() {
+                buf_.resize(pad4(buf_.size()));
+                return *this;
+        }
+
+        block_body& option(uint16_t code, std::span<std::byte const> value) {
+                return put(code).put(static_cast<uint16_t>(value.size())).put(value).pad();
+        }
+
+        block_body& end_of_options() { return put(kPcapngOptEnd).put(uint16_t{0}); }
+
+        std::span<std::byte const> bytes() const { return buf_; }
+
+private:
+        std::vector<std::byte>& buf_;
+};
+
+}  // namespace
+
+capture::capture(std::string_view path, std::string_view ifname, size_t snaplen)
+    : snaplen_(snaplen),
+      slot_size_((sizeof(record) + snaplen + 63) & ~size_t{63}),
+      ring_(std::make_unique<std::byte[]>(slot_size_ * kSlots)),
+      out_(std::string{path}, std::ios::binary | std::ios::trunc) {
+        if (!out_) throw std::runtime_error{std::format("[CAPTURE] OPEN {} FAIL", path)};
+
+        write_section(ifname);
+
+        writer_ = std::thread{[this] { drain(); }};
+
+        spdlog::info("[CAPTURE] {} TO {} SNAPLEN {}", ifname, path, snaplen_);
+}
+
+capture::~capture() noexcept {
+        stop_.store(true, std::memory_order_release);
+        writer_.join();
+}
+
+bool capture::push(direction dir, skbuff const& skb) noexcept {
+        auto const head{head_.load(std::memory_order_relaxed)};
+        if (!(head - tail_.load(std::memory_order_acquire) < kSlots)) return false;
+
+        auto const rec{record{
+                .ts_ns    = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::system_clock::now().time_since_epoch())
+                                 .count(),
+                .orig_len = static_cast<uint32_t>(skb.len()),
+                .cap_len  = static_cast<uint32_t>(std::min(skb.len(), snaplen_)),
+                .dir      = dir,
+        }};
+
+        auto* const slot{ring_.get() + head % kSlots * slot_size_};
+        std::memcpy(slot, &rec, sizeof(rec));
+
+        // as much of the fragments as the snaplen leaves room for
+        auto data{std::span{slot + sizeof(rec), rec.cap_len}};
+        auto part{std::min(data.size(), skb.payload().size())};
+        std::memcpy(data.data(), skb.payload().data(), part);
+        for (auto const& frag : skb.frags()) {
+                data = data.subspan(part);
+                if (data.empty()) break;
+                part = std::min(data.size(), frag.data.size());
+                std::memcpy(data.data(), frag.data.data(), part);
+        }
+
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+}
+
+void capture::drain() {
+        for (;;) {
+                // whatever was pushed before the stop request is written out
+                bool const stop{stop_.load(std::memory_order_acquire)};
+                auto const head{head_.load(std::memory_order_acquire)};
+                auto       tail{tail_.load(std::memory_order_relaxed)};
+
+                if (head == tail) {
+                        if (stop) break;
+                        out_.flush();
+                        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                        continue;
+                }
+
+                for (; tail != head; ++tail) {
+                        auto const* slot{ring_.get() + tail % kSlots * slot_size_};
+                        record      rec;
+                        std::memcpy(&rec, slot, sizeof(rec));
+                        write_packet(rec, slot + sizeof(rec));
+                        tail_.store(tail + 1, std::memory_order_release);
+                }
+        }
+
+        out_.flush();
+}
+
+void capture::write_block(uint32_t type, std::span<std::byte const> body) {
+        assert(0 == (body.size() & 3));
+
+        auto const len{static_cast<uint32_t>(12 + body.size())};
+        out_.write(reinterpret_cast<char const*>(&type), sizeof(type));
+        out_.write(reinterpret_cast<char const*>(&len), sizeof(len));
+        out_.write(reinterpret_cast<char const*>(body.data()),
+                   static_cast<std::streamsize>(body.size()));
+        out_.write(reinterpret_cast<char const*>(&len), sizeof(len));
+}
+
+void capture::write_section(std::string_view ifname) {
+        auto const shb{block_body{block_}
+                               .put(kPcapngByteOrderMagic)
+                               .put(uint16_t{1})
+                               .put(uint16_t{0})
+                               .put(int64_t{-1})  // section length unknown
+                               .end_of_options()
+                               .bytes()};
+        write_block(kPcapngSHB, shb);
+
+        auto const idb{block_body{block_}
+                               .put(kLinkTypeEthernet)
+                               .put(uint16_t{0})
+                               .put(static_cast<uint32_t>(snaplen_))
+                               .option(kPcapngOptIfName, std::as_bytes(std::span{ifname}))
+                               .option(kPcapngOptIfTsResol,
+                                       std::as_bytes(std::span{&kTsResolNsec, 1}))
+                               .end_of_options()
+                               .bytes()};
+        write_block(kPcapngIDB, idb);
+}
+
+void capture::write_packet(record const& rec, std::byte const* data) {
+        auto const ts{static_cast<uint64_t>(rec.ts_ns)};
+        // inbound or outbound in the two lowest bits
+        auto const flags{static_cast<uint32_t>(rec.dir)};
+
+        auto const epb{block_body{block_}
+                               .put(uint32_t{0})
+                               .put(static_cast<uint32_t>(ts >> 32))
+                               .put(static_cast<uint32_t>(ts))
+                               .put(rec.cap_len)
+                               .put(rec.orig_len)
+                               .put({data, rec.cap_len})
+                               .pad()
+                               .option(kPcapngOptEpbFlags, std::as_bytes(std::span{&flags, 1}))
+                               .end_of_options()
+                               .bytes()};
+        write_block(kPcapngEPB, epb);
+}
+
+}  // namespace mstack
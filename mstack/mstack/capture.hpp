@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  pcapng capture point of a device. The packet path copies each frame, cut
+ *  down to the snaplen, into a single-producer single-consumer ring and never
+ *  blocks: a frame that finds the ring full is left out of the capture. A
+ *  background thread drains the ring into the file.
+ */
+class capture {
+public:
+        static constexpr size_t kSnapLenDefault{128};
+        static constexpr size_t kSlots{4096};
+
+        enum class direction : uint8_t {
+                in  = 1,
+                out = 2,
+        };
+
+        /**
+         *  Writes to @path, @ifname naming the interface in the file
+         */
+        explicit capture(std::string_view path,
+                         std::string_view ifname,
+                         size_t           snaplen = kSnapLenDefault);
+        ~capture() noexcept;
+
+        capture(capture const&)            = delete;
+        capture& operator=(capture const&) = delete;
+
+        capture(capture&&)            = delete;
+        capture& operator=(capture&&) = delete;
+
+        /**
+         *  Called by the producer only, false if the frame has been dropped
+         */
+        bool push(direction dir, skbuff const& skb) noexcept;
+
+private:
+        struct record {
+                int64_t   ts_ns;
+                uint32_t  orig_len;
+                uint32_t  cap_len;
+                direction dir;
+        };
+
+        void drain();
+
+        void write_block(uint32_t type, std::span<std::byte const> body);
+
+        void write_section(std::string_view ifname);
+
+        void write_packet(record const& rec, std::byte const* data);
+
+        size_t                       snaplen_;
+        size_t                       slot_size_;
+        std::unique_ptr<std::byte[]> ring_;
+
+        alignas(64) std::atomic<size_t> head_{0};
+        alignas(64) std::atomic<size_t> tail_{0};
+        std::atomic<bool>               stop_{false};
+
+        std::ofstream          out_;
+        std::vector<std::byte> block_;
+        std::thread            writer_;
+};
+
+}  // namespace mstack
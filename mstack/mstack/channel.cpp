@@ -0,0 +1,40 @@
+#include "channel.hpp"
+
+#include <atomic>
+#include <utility>
+
+#include <boost/asio/post.hpp>
+
+namespace mstack {
+
+doorbell::doorbell(boost::asio::io_context& io_ctx,
+                   std::function<bool()>    drain,
+                   std::function<bool()>    pending)
+    : io_ctx_(io_ctx), drain_(std::move(drain)), pending_(std::move(pending)) {}
+
+void doorbell::ring() {
+        // pairs with the fence in run(): either the consumer sees what was
+        // pushed, or this sees the bell cleared and rings again
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (rung_.load(std::memory_order_relaxed) ||
+            rung_.exchange(true, std::memory_order_acq_rel))
+                return;
+        boost::asio::post(io_ctx_, [this] { run(); });
+}
+
+void doorbell::run() {
+        while (true) {
+                // still rung, the rest goes with a later turn of the loop
+                if (drain_()) {
+                        boost::asio::post(io_ctx_, [this] { run(); });
+                        return;
+                }
+
+                rung_.store(false, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (!pending_() || rung_.exchange(true, std::memory_order_acq_rel)) return;
+        }
+}
+
+}  // namespace mstack
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/io_context.hpp>
+
+namespace mstack {
+
+/**
+ *  Bounded ring between one producer thread and one consumer thread. Each side
+ *  keeps a copy of the other's index and reads the shared one only when the
+ *  copy says the ring is full or empty, so a message costs the transfer of the
+ *  cache line it sits in and little else.
+ */
+template <typename T>
+class spsc_ring {
+public:
+        static_assert(std::is_default_constructible_v<T> && std::is_move_assignable_v<T>);
+
+        explicit spsc_ring(size_t capacity)
+            : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+              slots_(std::make_unique<T[]>(mask_ + 1)) {}
+
+        spsc_ring(spsc_ring const&)            = delete;
+        spsc_ring& operator=(spsc_ring const&) = delete;
+
+        spsc_ring(spsc_ring&&)            = delete;
+        spsc_ring& operator=(spsc_ring&&) = delete;
+
+        /**
+         *  Producer only, @v is left untouched if the ring is full
+         */
+        bool try_push(T&& v) {
+                auto const tail{tail_.load(std::memory_order_relaxed)};
+                if (tail - head_seen_ > mask_) {
+                        head_seen_ = head_.load(std::memory_order_acquire);
+                        if (tail - head_seen_ > mask_) return false;
+                }
+                slots_[tail & mask_] = std::move(v);
+                tail_.store(tail + 1, std::memory_order_release);
+                return true;
+        }
+
+        /**
+         *  Consumer only, hands up to @max messages to @fn, oldest first
+         */
+        template <typename Fn>
+        size_t drain(Fn&& fn, size_t max) {
+                auto const head{head_.load(std::memory_order_relaxed)};
+                if (tail_seen_ - head < max) tail_seen_ = tail_.load(std::memory_order_acquire);
+
+                auto const n{std::min(tail_seen_ - head, max)};
+                for (size_t i{0}; i < n; ++i)
+                        fn(std::move(slots_[(head + i) & mask_]));
+                head_.store(head + n, std::memory_order_release);
+                return n;
+        }
+
+        bool empty() const {
+                return head_.load(std::memory_order_acquire) ==
+                       tail_.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return mask_ + 1; }
+
+private:
+        size_t               mask_;
+        std::unique_ptr<T[]> slots_;
+
+        alignas(64) std::atomic<size_t> head_{0};
+        size_t tail_seen_{0};
+
+        alignas(64) std::atomic<size_t> tail_{0};
+        size_t head_seen_{0};
+};
+
+/**
+ *  Bounded ring any number of threads push to and a single thread consumes,
+ *  each slot carries a sequence number telling whose turn it is (Vyukov).
+ *  Producers only contend on the tail index.
+ */
+template <typename T>
+class mpsc_ring {
+public:
+        static_assert(std::is_default_constructible_v<T> && std::is_move_assignable_v<T>);
+
+        explicit mpsc_ring(size_t capacity)
+            : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+              cells_(std::make_unique<cell[]>(mask_ + 1)) {
+                for (size_t i{0}; i <= mask_; ++i)
+                        cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        mpsc_ring(mpsc_ring const&)            = delete;
+        mpsc_ring& operator=(mpsc_ring const&) = delete;
+
+        mpsc_ring(mpsc_ring&&)            = delete;
+        mpsc_ring& operator=(mpsc_ring&&) = delete;
+
+        /**
+         *  Any thread, @v is left untouched if the ring is full
+         */
+        bool try_push(T&& v) {
+                auto  pos{tail_.load(std::memory_order_relaxed)};
+                cell* c{nullptr};
+                while (true) {
+                        c = &cells_[pos & mask_];
+                        auto const seq{c->seq.load(std::memory_order_acquire)};
+                        if (seq == pos) {
+                                if (tail_.compare_exchange_weak(pos, pos + 1,
+                                                                std::memory_order_relaxed))
+                                        break;
+                        } else if (seq < pos) {
+                                return false;
+                        } else {
+                                pos = tail_.load(std::memory_order_relaxed);
+                        }
+                }
+                c->value = std::move(v);
+                c->seq.store(pos + 1, std::memory_order_release);
+                return true;
+        }
+
+        /**
+         *  Consumer only, hands up to @max messages to @fn, oldest first
+         */
+        template <typename Fn>
+        size_t drain(Fn&& fn, size_t max) {
+                auto   pos{head_.load(std::memory_order_relaxed)};
+                size_t n{0};
+                for (; n < max; ++n, ++pos) {
+                        auto& c{cells_[pos & mask_]};
+                        if (c.seq.load(std::memory_order_acquire) != pos + 1) break;
+                        fn(std::move(c.value));
+                        c.seq.store(pos + mask_ + 1, std::memory_order_release);
+                }
+                head_.store(pos, std::memory_order_relaxed);
+                return n;
+        }
+
+        /**
+         *  Consumer only
+         */
+        bool empty() const {
+                auto const pos{head_.load(std::memory_order_relaxed)};
+                return cells_[pos & mask_].seq.load(std::memory_order_acquire) != pos + 1;
+        }
+
+        size_t capacity() const { return mask_ + 1; }
+
+private:
+        struct cell {
+                std::atomic<size_t> seq;
+                T                   value;
+        };
+
+        size_t                  mask_;
+        std::unique_ptr<cell[]> cells_;
+
+        alignas(64) std::atomic<size_t> head_{0};
+        alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/**
+ *  A callable run once, which unlike std::function may hold move-only state
+ */
+class task {
+public:
+        task() = default;
+
+        template <typename Fn>
+                requires(!std::is_same_v<std::remove_cvref_t<Fn>, task>)
+        task(Fn&& fn) : fn_(std::make_unique<impl<std::decay_t<Fn>>>(std::forward<Fn>(fn))) {}
+
+        void operator()() {
+                if (fn_) std::exchange(fn_, nullptr)->run();
+        }
+
+        explicit operator bool() const { return static_cast<bool>(fn_); }
+
+private:
+        struct base {
+                virtual ~base()    = default;
+                virtual void run() = 0;
+        };
+
+        template <typename Fn>
+        struct impl final : base {
+                explicit impl(Fn&& f) : fn(std::move(f)) {}
+                explicit impl(Fn const& f) : fn(f) {}
+                void run() override { fn(); }
+                Fn   fn;
+        };
+
+        std::unique_ptr<base> fn_;
+};
+
+/**
+ *  Wakes the consumer of a set of rings up on its io_context. Producers ring
+ *  it after pushing: only the first ring since the consumer last went idle
+ *  costs a post, later ones find it rung already and their messages go with
+ *  the same drain.
+ */
+class doorbell {
+public:
+        /**
+         *  @drain and @pending run on @io_ctx. @drain consumes a bounded amount
+         *  and returns true if it left messages behind, @pending tells whether
+         *  any are waiting.
+         */
+        doorbell(boost::asio::io_context& io_ctx,
+                 std::function<bool()>    drain,
+                 std::function<bool()>    pending);
+
+        doorbell(doorbell const&)            = delete;
+        doorbell& operator=(doorbell const&) = delete;
+
+        doorbell(doorbell&&)            = delete;
+        doorbell& operator=(doorbell&&) = delete;
+
+        /**
+         *  Any thread, after pushing
+         */
+        void ring();
+
+private:
+        void run();
+
+        boost::asio::io_context& io_ctx_;
+        std::function<bool()>    drain_;
+        std::function<bool()>    pending_;
+
+        alignas(64) std::atomic<bool> rung_{false};
+};
+
+}  // namespace mstack
@@ -0,0 +1,31 @@
+#include "congestion_control.hpp"
+
+#include <algorithm>
+
+#include "tcb.hpp"
+
+namespace mstack {
+
+void congestion_control::on_rto(send& snd) {
+        snd.state.ssthresh = std::max<uint32_t>(in_flight(snd) / 2, 2 * snd.state.mss);
+        snd.state.cwnd     = snd.state.mss;
+}
+
+uint32_t congestion_control::initial_window(uint16_t mss) {
+        return std::min<uint32_t>(10 * mss, std::max<uint32_t>(2 * mss, 14600));
+}
+
+uint32_t congestion_control::in_flight(send const& snd) {
+        return snd.state.seq_nr_max - snd.state.seq_nr_unack;
+}
+
+uint32_t congestion_control::slow_start(send& snd, uint32_t acked) {
+        if (!(snd.state.cwnd < snd.state.ssthresh)) return acked;
+
+        auto const cwnd{std::min<uint64_t>(uint64_t{snd.state.cwnd} + acked, snd.state.ssthresh)};
+        acked -= static_cast<uint32_t>(cwnd - snd.state.cwnd);
+        snd.state.cwnd = static_cast<uint32_t>(cwnd);
+        return acked;
+}
+
+}  // namespace mstack
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+
+#include <chrono>
+#include <string>
+
+namespace mstack {
+
+struct send;
+
+enum class cc_algorithm : uint8_t {
+        // RFC 5681 and RFC 6582
+        newreno,
+        // RFC 9438
+        cubic,
+        // BBR v1, draft-cardwell-iccrg-bbr-congestion-control-00
+        bbr,
+};
+
+/**
+ *  What an ACK tells of the rate data is delivered at, see delivery_rate
+ */
+struct rate_sample {
+        using clock = std::chrono::steady_clock;
+
+        // bytes delivered over @interval
+        uint64_t        delivered;
+        clock::duration interval;
+        // bytes delivered in all when the segment the sample is taken from was
+        // sent, and now
+        uint64_t prior_delivered;
+        uint64_t delivered_total;
+        // since that segment was sent
+        clock::duration rtt;
+        // newly acknowledged
+        uint32_t acked;
+        // the sender ran out of data meanwhile, the rate may be below what the
+        // path allows
+        bool app_limited;
+};
+
+/**
+ *  Congestion control algorithm of a connection. The connection runs slow
+ *  start thresholds, loss detection and recovery itself and calls the hooks
+ *  for the algorithm to move send.state.cwnd and send.state.ssthresh, on the
+ *  thread of the shard the connection belongs to.
+ */
+class congestion_control {
+public:
+        using clock = std::chrono::steady_clock;
+
+        virtual ~congestion_control() = default;
+
+        congestion_control(congestion_control const&)            = delete;
+        congestion_control& operator=(congestion_control const&) = delete;
+
+        congestion_control(congestion_control&&)            = delete;
+        congestion_control& operator=(congestion_control&&) = delete;
+
+        virtual std::string const& name() const = 0;
+
+        /**
+         *  @acked bytes newly acknowledged outside of fast recovery
+         */
+        virtual void on_ack(send& snd, uint32_t acked) = 0;
+
+        /**
+         *  Fast retransmit is about to start, send.state.ssthresh is to be set
+         *  for the recovery that follows
+         */
+        virtual void on_loss(send& snd) = 0;
+
+        /**
+         *  The retransmission timer went off, by default RFC 5681 (4) and a
+         *  loss window of one segment
+         */
+        virtual void on_rto(send& snd);
+
+        /**
+         *  Round trip time of a segment sent once, measured when its ACK came in
+         */
+        virtual void on_rtt_sample(send& snd [[maybe_unused]],
+                                   clock::duration rtt [[maybe_unused]]) {}
+
+        /**
+         *  Called for every ACK a delivery rate could be measured with, after
+         *  on_ack() or the recovery steps of the connection, so the algorithm
+         *  has the last word on cwnd
+         */
+        virtual void on_rate_sample(send& snd [[maybe_unused]],
+                                    rate_sample const& rs [[maybe_unused]]) {}
+
+        /**
+         *  Bytes per second segments with data are to be paced out at, 0 for
+         *  as fast as cwnd allows
+         */
+        virtual uint64_t pacing_rate() const { return 0; }
+
+        /**
+         *  RFC 6928
+         */
+        static uint32_t initial_window(uint16_t mss);
+
+protected:
+        congestion_control() = default;
+
+        /**
+         *  Bytes sent and not acknowledged yet
+         */
+        static uint32_t in_flight(send const& snd);
+
+        /**
+         *  RFC 5681 3.1 with byte counting: grows cwnd by @acked up to
+         *  ssthresh, returns what is left of @acked for congestion avoidance
+         */
+        static uint32_t slow_start(send& snd, uint32_t acked);
+};
+
+}  // namespace mstack
@@ -0,0 +1,87 @@
+#include "cubic.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+
+#include "tcb.hpp"
+
+namespace mstack {
+
+std::string const& cubic::name() const {
+        static std::string const kName{"cubic"};
+        return kName;
+}
+
+void cubic::on_ack(send& snd, uint32_t acked) {
+        acked = slow_start(snd, acked);
+        if (0 == acked) return;
+
+        auto const   now{clock::now()};
+        double const mss{static_cast<double>(snd.state.mss)};
+        double const cwnd{snd.state.cwnd / mss};
+
+        // RFC 9438 4.2, the curve starts at the first ACK after a reduction
+        if (!epoch_) {
+                epoch_ = now;
+                if (cwnd < w_max_) {
+                        k_      = std::cbrt((w_max_ - cwnd) / kC);
+                        origin_ = w_max_;
+                } else {
+                        k_      = 0;
+                        origin_ = cwnd;
+                }
+                w_est_     = cwnd;
+                cwnd_frac_ = 0;
+        }
+
+        auto const rtt{clock::duration::max() == rtt_min_ ? clock::duration::zero() : rtt_min_};
+        auto const w_cubic{[&](clock::duration since) {
+                auto const t{std::chrono::duration<double>(since).count()};
+                return origin_ + kC * std::pow(t - k_, 3);
+        }};
+
+        // RFC 9438 4.3, Reno's growth at the same average window
+        constexpr double kAlpha{3 * (1 - kBeta) / (1 + kBeta)};
+        w_est_ += (w_est_ < w_max_ ? kAlpha : 1.0) * (acked / mss) / cwnd;
+
+        double grow{0};
+        if (w_cubic(now - *epoch_) < w_est_) {
+                grow = w_est_ - cwnd;
+        } else {
+                // RFC 9438 4.4 and 4.5, towards where the curve is an RTT on
+                auto const target{std::clamp(w_cubic(now - *epoch_ + rtt), cwnd, 1.5 * cwnd)};
+                grow = (target - cwnd) / cwnd * (acked / mss);
+        }
+
+        cwnd_frac_ += std::max(grow, 0.0) * mss;
+        auto const whole{static_cast<uint32_t>(cwnd_frac_)};
+        snd.state.cwnd += whole;
+        cwnd_frac_ -= whole;
+}
+
+void cubic::on_loss(send& snd) {
+        double const cwnd{static_cast<double>(snd.state.cwnd) / snd.state.mss};
+
+        // RFC 9438 4.7, fast convergence: a flow losing again below the last
+        // plateau leaves room for newcomers
+        w_max_ = cwnd < w_max_ ? cwnd * (1 + kBeta) / 2 : cwnd;
+        epoch_.reset();
+
+        // RFC 9438 4.6
+        snd.state.ssthresh =
+                std::max(static_cast<uint32_t>(snd.state.cwnd * kBeta), 2u * snd.state.mss);
+}
+
+void cubic::on_rto(send& snd) {
+        // RFC 9438 4.8, Reno's loss window with CUBIC's reduction
+        on_loss(snd);
+        snd.state.cwnd = snd.state.mss;
+}
+
+void cubic::on_rtt_sample(send& snd [[maybe_unused]], clock::duration rtt) {
+        rtt_min_ = std::min(rtt_min_, rtt);
+}
+
+}  // namespace mstack
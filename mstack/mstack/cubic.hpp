@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+#include <optional>
+#include <string>
+
+#include "congestion_control.hpp"
+
+namespace mstack {
+
+/**
+ *  RFC 9438: after a loss the window grows along a cubic function of the time
+ *  since then, which plateaus around the window the loss happened at and
+ *  probes beyond it, so the growth is independent of the RTT. Where Reno would
+ *  be faster, as on short RTT paths, it follows an estimate of Reno instead.
+ *  The window is tracked in segments.
+ */
+class cubic : public congestion_control {
+public:
+        static constexpr double kC{0.4};
+        static constexpr double kBeta{0.7};
+
+        cubic() = default;
+        ~cubic() override = default;
+
+        std::string const& name() const override;
+
+        void on_ack(send& snd, uint32_t acked) override;
+
+        void on_loss(send& snd) override;
+
+        void on_rto(send& snd) override;
+
+        void on_rtt_sample(send& snd, clock::duration rtt) override;
+
+private:
+        // start of the current congestion avoidance stage, none in slow start
+        std::optional<clock::time_point> epoch_;
+
+        // window before the last reduction and where the curve plateaus
+        double w_max_{0};
+        double origin_{0};
+        // seconds it takes the curve to get back to origin_
+        double k_{0};
+        // Reno friendly estimate
+        double w_est_{0};
+        // fraction of a byte cwnd has grown by but not taken yet
+        double cwnd_frac_{0};
+
+        clock::duration rtt_min_{clock::duration::max()};
+};
+
+}  // namespace mstack
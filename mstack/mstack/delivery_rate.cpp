@@ -0,0 +1,60 @@
+#include "delivery_rate.hpp"
+
+#include <algorithm>
+
+namespace mstack {
+
+void delivery_rate::on_sent(uint32_t end_seq, bool idle, clock::time_point now) {
+        // nothing to measure against after a pause, the intervals start anew
+        if (idle) {
+                first_sent_time_ = now;
+                delivered_time_  = now;
+        }
+
+        sent_.push_back({
+                .end_seq         = end_seq,
+                .delivered       = delivered_,
+                .delivered_time  = delivered_time_,
+                .first_sent_time = first_sent_time_,
+                .sent_time       = now,
+                .app_limited     = 0 != app_limited_,
+        });
+}
+
+std::optional<rate_sample> delivery_rate::on_ack(uint32_t          una,
+                                                 uint32_t          acked,
+                                                 clock::time_point now) {
+        delivered_ += acked;
+        delivered_time_ = now;
+        if (0 != app_limited_ && delivered_ > app_limited_) app_limited_ = 0;
+
+        std::optional<sent_record> last;
+        while (!sent_.empty() && !(static_cast<int32_t>(una - sent_.front().end_seq) < 0)) {
+                last = sent_.front();
+                sent_.pop_front();
+        }
+        if (!last) return std::nullopt;
+
+        first_sent_time_ = last->sent_time;
+
+        auto const send_elapsed{last->sent_time - last->first_sent_time};
+        auto const ack_elapsed{delivered_time_ - last->delivered_time};
+        auto const interval{std::max(send_elapsed, ack_elapsed)};
+        if (!(interval > clock::duration::zero())) return std::nullopt;
+
+        return rate_sample{
+                .delivered       = delivered_ - last->delivered,
+                .interval        = interval,
+                .prior_delivered = last->delivered,
+                .delivered_total = delivered_,
+                .rtt             = now - last->sent_time,
+                .acked           = acked,
+                .app_limited     = last->app_limited,
+        };
+}
+
+void delivery_rate::on_app_limited(uint32_t in_flight) {
+        app_limited_ = std::max<uint64_t>(delivered_ + in_flight, 1);
+}
+
+}  // namespace mstack
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+
+#include <chrono>
+#include <deque>
+#include <optional>
+
+#include "congestion_control.hpp"
+
+namespace mstack {
+
+/**
+ *  Delivery rate estimation as in draft-cheng-iccrg-delivery-rate-estimation:
+ *  each segment with data remembers how much had been delivered when it went
+ *  out, its ACK turns the difference into a rate over the longer of the send
+ *  and the ACK intervals, which keeps ACK compression from inflating it.
+ *  Without SACK the sample comes from the latest segment a cumulative ACK
+ *  covers.
+ */
+class delivery_rate {
+public:
+        using clock = std::chrono::steady_clock;
+
+        /**
+         *  A segment ending at @end_seq went out at @now, with nothing in flight
+         *  before it if @idle
+         */
+        void on_sent(uint32_t end_seq, bool idle, clock::time_point now);
+
+        /**
+         *  An ACK moved SND.UNA to @una, @acked bytes on
+         */
+        std::optional<rate_sample> on_ack(uint32_t una, uint32_t acked, clock::time_point now);
+
+        /**
+         *  The sender has nothing left to send with @in_flight bytes in flight,
+         *  samples are app limited until those are delivered
+         */
+        void on_app_limited(uint32_t in_flight);
+
+        /**
+         *  Forgets the segments in flight, after a timeout they are sent again
+         */
+        void reset() { sent_.clear(); }
+
+private:
+        struct sent_record {
+                uint32_t          end_seq;
+                uint64_t          delivered;
+                clock::time_point delivered_time;
+                clock::time_point first_sent_time;
+                clock::time_point sent_time;
+                bool              app_limited;
+        };
+
+        std::deque<sent_record> sent_;
+
+        uint64_t          delivered_{0};
+        clock::time_point delivered_time_{};
+        // send time of the segment the last sample was taken from
+        clock::time_point first_sent_time_{};
+        // delivered_ has to get beyond for samples not to be app limited, 0
+        // if they are not
+        uint64_t app_limited_{0};
+};
+
+}  // namespace mstack
@@ -3,102 +3,332 @@
 #include <cassert>
 
 #include <algorithm>
-#include <array>
+#include <cerrno>
+#include <cstring>
 #include <memory>
-#include <tuple>
-
-#include <linux/if_tun.h>
-
-#include <boost/asio/buffer.hpp>
-#include <boost/asio/write.hpp>
 #include <stdexcept>
+#include <utility>
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include <spdlog/spdlog.h>
 
+#include "device_engine.hpp"
+#include "ethernet_header.hpp"
 #include "file_desc.hpp"
+#include "icmp.hpp"
+#include "link_engine.hpp"
 #include "netns.hpp"
+#include "offload.hpp"
+#include "packet_engine.hpp"
+#include "replay_engine.hpp"
 #include "skbuff.hpp"
+#include "tap_engine.hpp"
+#include "trace.hpp"
+#include "uring_engine.hpp"
+#include "xsk_engine.hpp"
 
 namespace mstack {
 
-template <typename Completion>
-void device::async_read_some(std::span<std::byte> buf, Completion&& completion) {
-        spdlog::debug("[DEV {}]: READ SOME MAX {} BYTES", ndev_, buf.size());
-        pfd_.async_read_some(boost::asio::buffer(buf), std::forward<Completion>(completion));
+namespace {
+
+std::unique_ptr<device_engine> make_engine(netns&           net,
+                                           std::string_view name,
+                                           device_io        engine,
+                                           bool             multi_queue) {
+        switch (engine) {
+                case device_io::epoll:
+                        return std::make_unique<tap_engine>(net.io_context_execution(), name,
+                                                            multi_queue);
+                case device_io::io_uring:
+                        return std::make_unique<uring_engine>(net.io_context_execution(),
+                                                              net.pool(), name, multi_queue);
+                case device_io::af_packet:
+                        return std::make_unique<packet_engine>(net.io_context_execution(),
+                                                               net.pool(), name, multi_queue);
+                case device_io::af_xdp:
+                        return std::make_unique<xsk_engine>(net.io_context_execution(), name);
+        }
+        assert(false);
+        return {};
 }
 
-template <typename Completion>
-void device::async_write(std::span<std::byte const> buf, Completion&& completion) {
-        spdlog::debug("[DEV {}]: WRITE EXACTLY {} BYTES", ndev_, buf.size());
-        boost::asio::async_write(pfd_, boost::asio::buffer(buf),
-                                 std::forward<Completion>(completion));
+// SIOC[GS]IFMTU want a socket, any socket
+ifreq if_request(std::string_view name) {
+        ifreq ifr{};
+        name = name.substr(0, std::min(name.size(), sizeof(ifr.ifr_name) - 1));
+        std::ranges::copy(name, std::begin(ifr.ifr_name));
+        return ifr;
 }
 
-void device::send_front_pkt_out() {
-        auto skb{std::move(out_skb_q_.front())};
-        auto buf{skb.payload()};
-        async_write(buf, [this, skb = std::move(skb)](boost::system::error_code const& ec,
-                                                      size_t nbytes [[maybe_unused]]) mutable {
-                if (ec) spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_, ec.what());
-                out_skb_q_.pop();
-                if (!out_skb_q_.empty()) send_front_pkt_out();
-        });
+}  // namespace
+
+size_t if_mtu(std::string_view name) {
+        auto sock{file_desc::from_fd(::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0))};
+        auto ifr{if_request(name)};
+        if (!sock || sock->ioctl(SIOCGIFMTU, ifr) < 0) return 0;
+        return static_cast<size_t>(ifr.ifr_mtu);
+}
+
+void if_set_mtu(std::string_view name, size_t mtu) {
+        auto sock{file_desc::from_fd(::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0))};
+        auto ifr{if_request(name)};
+        ifr.ifr_mtu = static_cast<int>(mtu);
+        if (!sock || sock->ioctl(SIOCSIFMTU, ifr) < 0)
+                throw std::runtime_error{
+                        std::format("[DEV {}] SET MTU {} FAIL {}", name, mtu, strerror(errno))};
+}
+
+size_t device_engine::mtu_max() const { return device::kMtuMax; }
+
+size_t device_engine::mtu() const { return if_mtu(name()); }
+
+void device_engine::set_mtu(size_t mtu) { if_set_mtu(name(), mtu); }
+
+void device_engine::deliver(device& dev, std::span<skbuff> skbs) { dev.receive(skbs); }
+
+void device_engine::resume_tx(device& dev) { dev.flush_tx(); }
+
+device_stats& device_engine::stats(device& dev) { return dev.stats_; }
+
+bool device_engine::pause_rx(device& dev) { return dev.pause_rx(); }
+
+void device::flush_tx() {
+        if (!out_skb_q_.empty()) {
+                ++stats_.tx_flushes;
+
+                auto const nframes{engine_->transmit(out_skb_q_)};
+
+                MSTACK_TRACE_EVENT(dev_tx, nframes, out_skb_q_.size(), 0,
+                                   reinterpret_cast<uintptr_t>(this));
+
+                stats_.tx_batch_max = std::max<uint64_t>(stats_.tx_batch_max, nframes);
+        }
+
+        // half the queue has to drain before senders and receiving go on, so
+        // they are not woken up for every single frame
+        if (tx_backlogged_ && !(out_skb_q_.size() > tx_limit_.depth / 2)) {
+                tx_backlogged_ = false;
+                spdlog::debug("[DEV {}] TX QUEUE DRAINED", name());
+
+                resume_rx();
+                net_.tcb_m().resume_tx();
+        }
+}
+
+bool device::pause_rx() {
+        // a frame received is taken up to the sockets within the same call, no
+        // queue on the way fills up. What piles up when receiving outpaces the
+        // stack is what it passes on: the replies in the TX queue, and the
+        // segments forwarded to shards that are behind.
+        bool const forward{net_.tcb_m().forward_backlogged()};
+        if (!tx_backlogged_ && !forward) return false;
+
+        if (forward) net_.tcb_m().wait_rx(weak_from_this());
+        if (!rx_paused_) {
+                rx_paused_ = true;
+                ++stats_.rx_pauses;
+                spdlog::debug("[DEV {}] RX PAUSED", name());
+        }
+        return true;
+}
+
+void device::resume_rx() {
+        if (!rx_paused_ || tx_backlogged_) return;
+
+        if (net_.tcb_m().forward_backlogged()) {
+                net_.tcb_m().wait_rx(weak_from_this());
+                return;
+        }
+
+        rx_paused_ = false;
+        spdlog::debug("[DEV {}] RX RESUMED", name());
+        engine_->resume_rx();
 }
 
 void device::process(skbuff&& skb_in) {
+        auto const offloads{engine_->offloads()};
+        bool const sw_gso{skb_in.offload().gso_size > 0 && !(offloads & kOffloadTSO4)};
+        bool const sw_csum{skb_in.offload().csum_partial && !(offloads & kOffloadCsum)};
+
+        // the software fallbacks want the frame in one piece, so do engines
+        // without gather writes
+        if (sw_gso || sw_csum || !(offloads & kOffloadSG)) skb_in.linearize(net_.pool());
+
+        if (sw_gso) {
+                for (auto& seg : gso_segment(std::move(skb_in), net_.pool())) {
+                        if (!(offloads & kOffloadCsum)) csum_help(seg);
+                        queue_tx(std::move(seg));
+                }
+                return;
+        }
+
+        if (!(offloads & kOffloadCsum)) csum_help(skb_in);
+        queue_tx(std::move(skb_in));
+}
+
+void device::queue_tx(skbuff&& skb_in) {
+        if (!(out_skb_q_.size() < tx_limit_.depth)) {
+                ++stats_.tx_queue_drops;
+                MSTACK_TRACE_EVENT(dev_tx_drop, 0, out_skb_q_.size(), 0,
+                                   reinterpret_cast<uintptr_t>(this));
+                if (drop_policy::tail == tx_limit_.policy || out_skb_q_.empty()) return;
+                out_skb_q_.pop();
+        }
+
+        if (capture_ && !capture_->push(capture::direction::out, skb_in))
+                ++stats_.capture_drops;
+
         out_skb_q_.push(std::move(skb_in));
-        if (1 == out_skb_q_.size()) send_front_pkt_out();
-}
-
-void device::async_receive() {
-        auto  buf{std::make_unique_for_overwrite<std::byte[]>(1500)};
-        auto* p_buf{buf.get()};
-        async_read_some({p_buf, 1500},
-                        [this, buf = std::move(buf)](boost::system::error_code const& ec,
-                                                     size_t nbytes) mutable {
-                                if (ec) {
-                                        spdlog::warn("[DEV {}] RECEIVE FAIL {}", ndev_, ec.what());
-                                        async_receive();
-                                        return;
-                                }
-                                spdlog::debug("[DEV {}] RECEIVE {}", ndev_, nbytes);
-                                net_.eth().receive(skbuff{std::move(buf), 1500, 0, 1500 - nbytes},
-                                                   shared_from_this());
-                                async_receive();
-                        });
-}
-
-device::device(netns& net /* = netns::_default_()*/, std::string_view name /* = ""*/)
-    : net_(net), pfd_(net_.io_context_execution()) {
-        auto fd{file_desc::open("/dev/net/tun", file_desc::RDWR | file_desc::NONBLOCK)};
-        if (!fd) throw std::runtime_error{std::format("[TAP] OPEN FAIL")};
-
-        spdlog::debug("[TAP] DEV FD {}", fd->get_fd());
+        if (!(out_skb_q_.size() < tx_limit_.depth)) tx_backlogged_ = true;
 
-        ifreq ifr{};
+        if (!(out_skb_q_.size() < tx_batch_)) {
+                flush_tx();
+        } else if (!tx_flush_pending_) {
+                tx_flush_pending_ = true;
+                net_.io_context_execution().post([this] {
+                        tx_flush_pending_ = false;
+                        flush_tx();
+                });
+        }
+}
 
-        ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+void device::receive(std::span<skbuff> skbs_in) {
+        assert(!skbs_in.empty());
 
-        name = name.substr(0, std::min(name.size(), sizeof(ifr.ifr_name) - 1));
-        std::ranges::copy(name, std::begin(ifr.ifr_name));
+        ++stats_.rx_wakeups;
+        stats_.rx_packets += skbs_in.size();
+        uint64_t bytes{0};
+        for (auto const& skb_in : skbs_in)
+                bytes += skb_in.payload().size();
+        stats_.rx_bytes += bytes;
+        stats_.rx_batch_max = std::max<uint64_t>(stats_.rx_batch_max, skbs_in.size());
+
+        MSTACK_TRACE_EVENT(dev_rx, skbs_in.size(), bytes, 0,
+                           reinterpret_cast<uintptr_t>(this));
+
+        if (capture_)
+                for (auto const& skb_in : skbs_in)
+                        if (!capture_->push(capture::direction::in, skb_in))
+                                ++stats_.capture_drops;
+
+        // up to the sockets with direct calls, the protocols wired in at compile time
+        net_.eth().receive(skbs_in, shared_from_this());
+}
+
+device::device(netns&           net /* = netns::_default_()*/,
+               std::string_view name /* = ""*/,
+               device_io        engine /* = device_io::epoll*/,
+               bool             multi_queue /* = false*/)
+    : device(net, make_engine(net, name, engine, multi_queue)) {}
+
+device::device(netns& net, std::unique_ptr<device_engine> engine)
+    : net_(net), engine_(std::move(engine)) {
+        assert(engine_);
+
+        if (auto const mtu{engine_->mtu()}; 0 == mtu) {
+                spdlog::warn("[DEV {}] MTU UNKNOWN, {} ASSUMED", name(), mtu_);
+        } else if (mtu > mtu_max()) {
+                spdlog::warn("[DEV {}] MTU {} ABOVE {}, CAPPED", name(), mtu, mtu_max());
+                mtu_ = mtu_max();
+        } else {
+                mtu_ = mtu;
+        }
+
+        engine_->start(*this);
+}
+
+device::~device() noexcept = default;
+
+std::vector<std::shared_ptr<device>> device::create_multi_queue(
+        std::span<std::reference_wrapper<netns> const> nets,
+        std::string_view                               name /* = ""*/,
+        device_io                                      engine /* = device_io::epoll*/) {
+        assert(!nets.empty());
+
+        std::vector<std::shared_ptr<device>> queues;
+        queues.reserve(nets.size());
+
+        for (auto& net : nets) {
+                // the first queue creates the interface, the rest attach to it by name
+                queues.push_back(create(net.get(), queues.empty() ? name : queues.front()->name(),
+                                        engine, true));
+        }
 
-        if (int ec{fd->ioctl(TUNSETIFF, ifr)}; ec < 0)
-                throw std::runtime_error{std::format("[TAP] SETUP FAIL")};
+        return queues;
+}
+
+std::pair<std::shared_ptr<device>, std::shared_ptr<device>> device::create_pair(
+        netns&           net_a,
+        netns&           net_b,
+        std::string_view name_a /* = "link0"*/,
+        std::string_view name_b /* = "link1"*/,
+        queue_limit      limit /* = {}*/) {
+        auto [a, b]{link_engine::make_pair(net_a.io_context_execution(), name_a,
+                                           net_b.io_context_execution(), name_b, limit)};
+        return {create(net_a, std::move(a)), create(net_b, std::move(b))};
+}
+
+std::shared_ptr<device> device::create_replay(netns&           net,
+                                              std::string_view path,
+                                              replay_options   opts /* = {}*/) {
+        return create(net, std::make_unique<replay_engine>(net.io_context_execution(), net.pool(),
+                                                           path, std::move(opts)));
+}
 
-        ndev_.assign(ifr.ifr_name);
+std::string const& device::name() const { return engine_->name(); }
 
-        pfd_.assign(fd->get_fd());
+size_t device::rx_batch() const { return rx_batch_; }
 
-        async_receive();
+void device::set_rx_batch(size_t n) {
+        assert(n > 0);
+        rx_batch_ = n;
+}
+
+size_t device::tx_batch() const { return tx_batch_; }
+
+queue_limit const& device::tx_limit() const { return tx_limit_; }
 
-        std::ignore = fd->release();
+void device::set_tx_limit(queue_limit limit) {
+        assert(limit.depth > 0);
+        tx_limit_ = limit;
 }
 
-device::~device() noexcept { ::close(pfd_.native_handle()); }
+bool device::tx_backlogged() const { return tx_backlogged_; }
+
+void device::set_tx_batch(size_t n) {
+        assert(n > 0);
+        tx_batch_ = n;
+}
+
+size_t device::mtu() const { return mtu_; }
+
+void device::set_mtu(size_t mtu) {
+        if (mtu < kMtuMin || mtu > mtu_max())
+                throw std::runtime_error{std::format("[DEV {}] MTU {} OUT OF RANGE {}-{}", name(),
+                                                     mtu, kMtuMin, mtu_max())};
+
+        engine_->set_mtu(mtu);
+        mtu_ = mtu;
+
+        spdlog::info("[DEV {}] MTU {}", name(), mtu_);
+}
+
+size_t device::mtu_max() const { return std::min(kMtuMax, engine_->mtu_max()); }
+
+size_t device::rx_frame_size() const { return ethernetv2_header_t::size() + mtu_; }
+
+void device::start_capture(std::string_view path, size_t snaplen /* = capture::kSnapLenDefault*/) {
+        // the running capture, if any, is drained and closed first
+        capture_.reset();
+        capture_ = std::make_unique<capture>(path, name(), snaplen);
+}
 
-std::string const& device::name() const { return ndev_; }
+void device::stop_capture() { capture_.reset(); }
 
-auto& device::get_executor() { return pfd_.get_executor(); }
+device_stats const& device::stats() const { return stats_; }
 
 netns&       device::net() { return net_; }
 netns const& device::net() const { return net_; }
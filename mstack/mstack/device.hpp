@@ -2,50 +2,133 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 
+#include <functional>
 #include <memory>
 #include <queue>
 #include <span>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/posix/stream_descriptor.hpp>
-
+#include "capture.hpp"
+#include "device_engine.hpp"
 #include "netns.hpp"
+#include "queue_limit.hpp"
+#include "replay_engine.hpp"
 #include "skbuff.hpp"
 
 namespace mstack {
 
 class netns;
 
+struct device_stats {
+        uint64_t rx_packets;
+        uint64_t rx_bytes;
+        uint64_t rx_errors;
+        uint64_t rx_wakeups;
+        uint64_t rx_batch_max;
+        uint64_t tx_packets;
+        uint64_t tx_bytes;
+        uint64_t tx_errors;
+        uint64_t tx_flushes;
+        uint64_t tx_batch_max;
+        // frames the TX queue had no room for
+        uint64_t tx_queue_drops;
+        // times receiving stopped for the TX queue to drain, or for the shards
+        // segments are forwarded to to catch up
+        uint64_t rx_pauses;
+        uint64_t capture_drops;
+};
+
+enum class device_io {
+        epoll,
+        io_uring,
+        // an existing interface rather than a TAP, see packet_engine
+        af_packet,
+        // an existing interface through AF_XDP, queue 0 only, see xsk_engine
+        af_xdp,
+};
+
 class device : public std::enable_shared_from_this<device> {
 private:
-        netns&                                net_;
-        boost::asio::posix::stream_descriptor pfd_;
-        std::string                           ndev_;
-        std::queue<skbuff>                    out_skb_q_;
+        friend class device_engine;
+
+        netns&                         net_;
+        std::unique_ptr<device_engine> engine_;
+        std::queue<skbuff>             out_skb_q_;
+        size_t                         rx_batch_{kRxBatchDefault};
+        size_t                         tx_batch_{kTxBatchDefault};
+        size_t                         mtu_{kMtuDefault};
+        queue_limit                    tx_limit_{};
+        bool                           tx_flush_pending_{false};
+        bool                           tx_backlogged_{false};
+        bool                           rx_paused_{false};
+        device_stats                   stats_{};
+        std::unique_ptr<capture>       capture_;
 
-        template <typename Completion>
-        void async_read_some(std::span<std::byte> buf, Completion&& completion);
+        void receive(std::span<skbuff> skbs_in);
 
-        template <typename Completion>
-        void async_write(std::span<std::byte const> buf, Completion&& completion);
+        void queue_tx(skbuff&& skb_in);
 
-        void send_front_pkt_out();
+        void flush_tx();
 
-        void async_receive();
+        bool pause_rx();
 
-        explicit device(netns& net = netns::_default_(), std::string_view name = "");
+        explicit device(netns&           net         = netns::_default_(),
+                        std::string_view name        = "",
+                        device_io        engine      = device_io::epoll,
+                        bool             multi_queue = false);
+
+        explicit device(netns& net, std::unique_ptr<device_engine> engine);
 
 public:
+        static constexpr size_t kRxBatchDefault{32};
+        static constexpr size_t kTxBatchDefault{32};
+        static constexpr size_t kMtuDefault{1500};
+        static constexpr size_t kMtuMin{576};
+        static constexpr size_t kMtuMax{9216};
+
         template <typename... Args>
         static std::shared_ptr<device> create(Args&&... args) {
                 return std::shared_ptr<device>{new device{std::forward<Args>(args)...}};
         }
         ~device() noexcept;
 
+        /**
+         *  Opens the interface @name with one queue per netns of @nets, TAP
+         *  queues (IFF_MULTI_QUEUE) or a PACKET_FANOUT group for af_packet. The
+         *  kernel spreads flows across the queues, each one feeding the stack of
+         *  its own netns, so running the io_contexts of @nets on separate threads
+         *  spreads the packet processing of the interface across cores.
+         */
+        static std::vector<std::shared_ptr<device>> create_multi_queue(
+                std::span<std::reference_wrapper<netns> const> nets,
+                std::string_view                               name   = "",
+                device_io                                      engine = device_io::epoll);
+
+        /**
+         *  Two devices of @net_a and @net_b connected back to back in memory, see
+         *  link_engine. Needs neither root nor /dev/net/tun. Up to @limit frames
+         *  wait on the link each way.
+         */
+        static std::pair<std::shared_ptr<device>, std::shared_ptr<device>> create_pair(
+                netns&           net_a,
+                netns&           net_b,
+                std::string_view name_a = "link0",
+                std::string_view name_b = "link1",
+                queue_limit      limit  = {});
+
+        /**
+         *  Device of @net replaying the capture @path as received traffic, see
+         *  replay_engine
+         */
+        static std::shared_ptr<device> create_replay(netns&           net,
+                                                     std::string_view path,
+                                                     replay_options   opts = {});
+
         device(const device&) = delete;
         device(device&&)      = delete;
 
@@ -54,10 +137,59 @@ public:
 
         std::string const& name() const;
 
-        auto& get_executor();
-
         void process(skbuff&& skb_in);
 
+        size_t rx_batch() const;
+        void   set_rx_batch(size_t n);
+
+        /**
+         *  Queued frames are flushed as soon as @n of them are pending, or
+         *  at the end of the current event loop iteration otherwise
+         */
+        size_t tx_batch() const;
+        void   set_tx_batch(size_t n);
+
+        /**
+         *  Depth and drop policy of the TX queue. A full queue marks the device
+         *  backlogged: TCP stops generating segments for it and engines that
+         *  support it stop reading, until the queue has drained to half its
+         *  depth.
+         */
+        queue_limit const& tx_limit() const;
+        void               set_tx_limit(queue_limit limit);
+
+        bool tx_backlogged() const;
+
+        /**
+         *  Has the engine read again if it stopped and neither the TX queue nor
+         *  the shards segments are forwarded to hold it back any more
+         */
+        void resume_rx();
+
+        /**
+         *  Taken over from the interface when the device is created. Setting it
+         *  changes the MTU of the interface as well, RX buffers are sized after
+         *  it and TCP derives the MSS of new connections routed here from it.
+         */
+        size_t mtu() const;
+        size_t mtu_max() const;
+        void   set_mtu(size_t mtu);
+
+        /**
+         *  The largest frame the device receives, ethernet header included
+         */
+        size_t rx_frame_size() const;
+
+        /**
+         *  Starts copying the frames going through the device, up to @snaplen
+         *  bytes of each, to the pcapng file @path. The packet path does not wait
+         *  for the file, frames it has no room for are counted as capture_drops.
+         */
+        void start_capture(std::string_view path, size_t snaplen = capture::kSnapLenDefault);
+        void stop_capture();
+
+        device_stats const& stats() const;
+
         netns&       net();
         netns const& net() const;
 };
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <queue>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "skbuff.hpp"
+
+namespace mstack {
+
+class device;
+struct device_stats;
+
+/**
+ *  I/O backend of a device. The device owns the generic part of the data path
+ *  (TX queueing and flush scheduling, handing received frames up to the stack,
+ *  statistics), an engine owns the file descriptors and the way frames get in
+ *  and out of them.
+ */
+class device_engine {
+public:
+        virtual ~device_engine() = default;
+
+        device_engine(device_engine const&)            = delete;
+        device_engine& operator=(device_engine const&) = delete;
+
+        device_engine(device_engine&&)            = delete;
+        device_engine& operator=(device_engine&&) = delete;
+
+        virtual std::string const& name() const = 0;
+
+        /**
+         *  kOffload* flags of the work the backend does on outgoing frames, the
+         *  device falls back to software for the rest
+         */
+        virtual uint32_t offloads() const { return 0; }
+
+        /**
+         *  The largest MTU the backend can carry frames of, the interface may be
+         *  configured with a larger one still
+         */
+        virtual size_t mtu_max() const;
+
+        /**
+         *  MTU of the interface behind the backend, 0 if it cannot be read.
+         *  Setting it throws if the interface refuses.
+         */
+        virtual size_t mtu() const;
+        virtual void   set_mtu(size_t mtu);
+
+        /**
+         *  Starts receiving frames on behalf of @dev
+         */
+        virtual void start(device& dev) = 0;
+
+        /**
+         *  Takes frames off the front of @skbs for as long as the backend accepts
+         *  them and returns how many of them have been sent out. Frames left in @skbs
+         *  are retried by the next flush, a blocked engine asks for one with
+         *  resume_tx() as soon as it can make progress again.
+         */
+        virtual size_t transmit(std::queue<skbuff>& skbs) = 0;
+
+        /**
+         *  Starts reading again after pause_rx(), only called for engines that
+         *  paused
+         */
+        virtual void resume_rx() {}
+
+protected:
+        device_engine() = default;
+
+        static void          deliver(device& dev, std::span<skbuff> skbs);
+        static void          resume_tx(device& dev);
+        static device_stats& stats(device& dev);
+
+        /**
+         *  true if @dev is backlogged, the engine is to stop reading then and
+         *  gets a resume_rx() once it may go on
+         */
+        static bool pause_rx(device& dev);
+};
+
+/**
+ *  MTU of the kernel interface @name, 0 if it cannot be read
+ */
+size_t if_mtu(std::string_view name);
+
+/**
+ *  Sets the MTU of the kernel interface @name, throws if the kernel refuses
+ */
+void if_set_mtu(std::string_view name, size_t mtu);
+
+}  // namespace mstack
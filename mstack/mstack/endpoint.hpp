@@ -28,6 +28,15 @@ struct endpoint {
 
         auto operator<=>(const endpoint& rhs) const = default;
 
+        /**
+         *  true if a listener bound here takes connections to @local_ep, a 0
+         *  address or port standing for any
+         */
+        bool covers(endpoint const& local_ep) const {
+                return (0 == addrv4.raw() || addrv4 == local_ep.addrv4) &&
+                       (0 == addrv4_port || addrv4_port == local_ep.addrv4_port);
+        }
+
         friend std::ostream& operator<<(std::ostream& out, endpoint const& p) {
                 out << p.addrv4;
                 out << ":";
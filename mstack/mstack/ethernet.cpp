@@ -8,6 +8,7 @@
 #include "ethernet_header.hpp"
 
 #include "device.hpp"
+#include "trace.hpp"
 
 namespace mstack {
 
@@ -16,7 +17,7 @@ ethernetv2::ethernetv2(boost::asio::io_context& io_ctx) : base_protocol(io_ctx)
 void ethernetv2::process(ethernetv2_frame&& in_frame) {
         assert(in_frame.dev);
 
-        spdlog::debug("[ETH] HDL FROM U-LAYER {} from dev {}", in_frame, in_frame.dev->name());
+        MSTACK_TRACE_EVENT(eth_tx, in_frame.proto, in_frame.skb.len());
 
         auto const e_packet = ethernetv2_header_t{
                 .dst_mac_addr = in_frame.dst_mac_addr,
@@ -36,7 +37,7 @@ std::optional<ethernetv2_frame> ethernetv2::make_packet(skbuff&&
         auto const eth_header{ethernetv2_header_t::consume_from_net(skb_in.head())};
         skb_in.pop_front(ethernetv2_header_t::size());
 
-        spdlog::debug("[ETH] RECEIVE {}", eth_header);
+        MSTACK_TRACE_EVENT(eth_rx, eth_header.proto, skb_in.len());
 
         return ethernetv2_frame{
                 .src_mac_addr = eth_header.src_mac_addr,
@@ -7,7 +7,13 @@
 
 namespace mstack {
 
-class ethernetv2 : public base_protocol<void, ethernetv2_frame> {
+class arp;
+class ipv4;
+
+class ethernetv2 final : public base_protocol<void,
+                                              ethernetv2_frame,
+                                              upper_proto<0x0800, ipv4>,
+                                              upper_proto<0x0806, arp>> {
 public:
         explicit ethernetv2(boost::asio::io_context& io_ctx);
         ~ethernetv2() = default;
@@ -10,7 +10,7 @@
 
 namespace mstack {
 
-class icmp : public base_protocol<ipv4_packet, void> {
+class icmp final : public base_protocol<ipv4_packet, void> {
 public:
         static constexpr uint16_t PROTO{0x01};
 
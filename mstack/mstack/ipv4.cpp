@@ -17,6 +17,7 @@
 #include "mstack/neigh_cache.hpp"
 #include "routing_table.hpp"
 #include "size_literals.hpp"
+#include "trace.hpp"
 
 namespace mstack {
 
@@ -30,13 +31,14 @@ ipv4::ipv4(boost::asio::io_context&             io_ctx,
 }
 
 void ipv4::process(ipv4_packet&& pkt_in) {
-        spdlog::debug("[IPV4] HDL FROM U-LAYER {}", pkt_in);
+        MSTACK_TRACE_EVENT(ipv4_tx, pkt_in.proto, pkt_in.src_addrv4.raw(), pkt_in.dst_addrv4.raw(),
+                           pkt_in.skb.len());
 
         auto const ipv4h = ipv4_header_t{
                 .version      = 0x4,
                 .hlen         = 0x5,
                 .tos          = 0x0,
-                .total_length = static_cast<uint16_t>(pkt_in.skb.payload().size() +
+                .total_length = static_cast<uint16_t>(pkt_in.skb.len() +
                                                       ipv4_header_t::fixed_size()),
                 .id           = seq_++,
                 .NOP          = 0,
@@ -97,8 +99,6 @@ void ipv4::process(ipv4_packet&& pkt_in) {
 }
 
 std::optional<ipv4_packet> ipv4::make_packet(ethernetv2_frame&& frame_in) {
-        spdlog::debug("[IPV4] HDL FROM L-LAYER {}", frame_in);
-
         assert(!(frame_in.skb.payload().size() < ipv4_header_t::fixed_size()));
 
         if (auto const fb{frame_in.skb.payload()[0]}; 0x4_b != ((fb >> 4) & 0xf_b)) return {};
@@ -108,7 +108,8 @@ std::optional<ipv4_packet> ipv4::make_packet(ethernetv2_frame&& frame_in) {
         assert(!(hlen < ipv4_header_t::fixed_size()));
         frame_in.skb.pop_front(hlen);
 
-        spdlog::debug("[IPv4] RECEIVE {}", ipv4_header);
+        MSTACK_TRACE_EVENT(ipv4_rx, ipv4_header.proto_type, ipv4_header.src_addr.raw(),
+                           ipv4_header.dst_addr.raw(), frame_in.skb.len());
 
         return ipv4_packet{
                 .src_addrv4 = ipv4_header.src_addr,
@@ -14,9 +14,14 @@
 
 namespace mstack {
 
+class icmp;
 class routing_table;
+class tcp;
 
-class ipv4 : public base_protocol<ethernetv2_frame, ipv4_packet> {
+class ipv4 final : public base_protocol<ethernetv2_frame,
+                                        ipv4_packet,
+                                        upper_proto<0x01, icmp>,
+                                        upper_proto<0x06, tcp>> {
 public:
         constexpr static uint16_t PROTO{0x0800};
 
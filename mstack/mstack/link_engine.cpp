@@ -0,0 +1,247 @@
+#include "link_engine.hpp"
+
+#include <cassert>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "device.hpp"
+#include "netns.hpp"
+#include "offload.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+struct link_engine::wire {
+        boost::asio::io_context& io_ctx;     // of the receiving end
+        boost::asio::io_context& tx_io_ctx;  // of the sending end
+        bool const               shared_io_ctx;
+        queue_limit const        limit;
+
+        std::mutex          mtx;
+        std::vector<skbuff> skbs;
+        queue_stats         stats{};
+        bool                drain_pending{false};
+        // the receiver stopped taking frames until its device resumes it,
+        // drain_pending stays set meanwhile
+        bool rx_paused{false};
+        // the sender left frames behind for want of room, it gets a flush
+        // once the receiver has taken what is on the wire
+        bool tx_stalled{false};
+
+        link_engine* receiver{nullptr};
+        link_engine* sender{nullptr};
+};
+
+namespace {
+
+// the linear part copied to the heap, the skbuff may be released on a thread
+// the pool of the original one does not belong to. Fragments are shared as
+// they are, their owners are not tied to a thread.
+skbuff detach(skbuff const& skb) {
+        auto const room{skb.headroom() + skb.payload().size()};
+
+        auto copy{skbuff{std::make_unique_for_overwrite<std::byte[]>(room), room, skb.headroom()}};
+        std::ranges::copy(skb.payload(), copy.head());
+        copy.offload() = skb.offload();
+        for (auto const& frag : skb.frags())
+                copy.add_frag(frag.data, frag.owner);
+
+        return copy;
+}
+
+}  // namespace
+
+link_engine::end_pair link_engine::make_pair(boost::asio::io_context& io_ctx_a,
+                                             std::string_view         name_a,
+                                             boost::asio::io_context& io_ctx_b,
+                                             std::string_view         name_b,
+                                             queue_limit              limit /* = {}*/) {
+        bool const shared{&io_ctx_a == &io_ctx_b};
+
+        auto a_to_b{std::make_shared<wire>(io_ctx_b, io_ctx_a, shared, limit)};
+        auto b_to_a{std::make_shared<wire>(io_ctx_a, io_ctx_b, shared, limit)};
+
+        return {
+                std::unique_ptr<link_engine>{new link_engine{name_a, b_to_a, a_to_b}},
+                std::unique_ptr<link_engine>{new link_engine{name_b, a_to_b, b_to_a}},
+        };
+}
+
+link_engine::link_engine(std::string_view      name,
+                         std::shared_ptr<wire> rx,
+                         std::shared_ptr<wire> tx)
+    : ndev_(name), mtu_(device::kMtuDefault), rx_(std::move(rx)), tx_(std::move(tx)) {
+        {
+                std::lock_guard lock{rx_->mtx};
+                rx_->receiver = this;
+        }
+        std::lock_guard lock{tx_->mtx};
+        tx_->sender = this;
+}
+
+link_engine::~link_engine() noexcept {
+        // frames still on their way to us die with the wire
+        {
+                std::lock_guard lock{rx_->mtx};
+                rx_->receiver = nullptr;
+        }
+        std::lock_guard lock{tx_->mtx};
+        tx_->sender = nullptr;
+}
+
+std::string const& link_engine::name() const { return ndev_; }
+
+uint32_t link_engine::offloads() const {
+        return kOffloadCsum | kOffloadTSO4 | kOffloadSG;
+}
+
+size_t link_engine::mtu() const { return mtu_; }
+
+void link_engine::set_mtu(size_t mtu) { mtu_ = mtu; }
+
+void link_engine::start(device& dev) {
+        dev_ = &dev;
+        in_skbs_.reserve(dev_->rx_batch());
+
+        // the other end may have been sending already
+        std::lock_guard lock{rx_->mtx};
+        if (!rx_->skbs.empty()) {
+                rx_->drain_pending = true;
+                post_drain(rx_);
+        }
+}
+
+void link_engine::resume_rx() { post_drain(rx_); }
+
+void link_engine::post_drain(std::shared_ptr<wire> const& w) {
+        w->io_ctx.post([w] {
+                link_engine* end;
+                {
+                        std::lock_guard lock{w->mtx};
+                        end = w->receiver;
+                }
+                // not started yet, start() asks again
+                if (end && end->dev_) end->receive_batch();
+        });
+}
+
+void link_engine::post_resume(std::shared_ptr<wire> const& w) {
+        w->tx_io_ctx.post([w] {
+                link_engine* end;
+                {
+                        std::lock_guard lock{w->mtx};
+                        end = w->sender;
+                }
+                if (end && end->dev_) resume_tx(*end->dev_);
+        });
+}
+
+void link_engine::receive_batch() {
+        assert(dev_);
+        assert(in_skbs_.empty());
+
+        bool resume;
+        {
+                std::lock_guard lock{rx_->mtx};
+                // a full link is taken in any case, two ends pausing for each
+                // other would wait for good
+                if (!rx_->tx_stalled && pause_rx(*dev_)) {
+                        rx_->rx_paused = true;
+                        return;
+                }
+                rx_->rx_paused     = false;
+                rx_->drain_pending = false;
+                std::swap(in_skbs_, rx_->skbs);
+                resume = std::exchange(rx_->tx_stalled, false);
+        }
+        if (resume) post_resume(rx_);
+
+        // the receive path parses the linear part only
+        for (auto& skb : in_skbs_)
+                skb.linearize(dev_->net().pool());
+
+        for (std::span<skbuff> skbs{in_skbs_}; !skbs.empty();) {
+                auto const n{std::min(skbs.size(), dev_->rx_batch())};
+                deliver(*dev_, skbs.first(n));
+                skbs = skbs.subspan(n);
+        }
+        in_skbs_.clear();
+}
+
+size_t link_engine::transmit(std::queue<skbuff>& skbs) {
+        assert(dev_);
+
+        // as many frames as the wire has room for, all of them if the oldest
+        // ones on it give way
+        size_t room;
+        bool   wake{false};
+        {
+                std::lock_guard lock{tx_->mtx};
+                if (!tx_->receiver) {
+                        stats(*dev_).tx_errors += skbs.size();
+                        spdlog::warn("[DEV {}] WRITE FAIL OTHER END GONE", ndev_);
+                        auto const nframes{skbs.size()};
+                        skbs = {};
+                        return nframes;
+                }
+
+                room = drop_policy::head == tx_->limit.policy
+                               ? skbs.size()
+                               : tx_->limit.depth - std::min(tx_->limit.depth, tx_->skbs.size());
+                // set ahead, a receiver draining meanwhile has us flush again
+                if (room < skbs.size()) {
+                        tx_->tx_stalled = true;
+                        wake            = std::exchange(tx_->rx_paused, false);
+                }
+        }
+        if (wake) post_drain(tx_);
+
+        auto const nframes{std::min(room, skbs.size())};
+
+        std::vector<skbuff> out;
+        out.reserve(nframes);
+        for (size_t i{0}; i < nframes; ++i, skbs.pop()) {
+                stats(*dev_).tx_bytes += skbs.front().len();
+                out.push_back(tx_->shared_io_ctx ? std::move(skbs.front()) : detach(skbs.front()));
+        }
+        stats(*dev_).tx_packets += nframes;
+
+        bool drain{false};
+        {
+                std::lock_guard lock{tx_->mtx};
+                if (!tx_->receiver) {
+                        stats(*dev_).tx_errors += nframes;
+                        spdlog::warn("[DEV {}] WRITE FAIL OTHER END GONE", ndev_);
+                        return nframes;
+                }
+                std::ranges::move(out, std::back_inserter(tx_->skbs));
+
+                // only ever above the limit if the oldest frames give way
+                if (tx_->skbs.size() > tx_->limit.depth) {
+                        auto const over{tx_->skbs.size() - tx_->limit.depth};
+                        tx_->skbs.erase(tx_->skbs.begin(),
+                                        tx_->skbs.begin() + static_cast<ptrdiff_t>(over));
+                        tx_->stats.drops += over;
+                        stats(*dev_).tx_queue_drops += over;
+                        spdlog::debug("[DEV {}] LINK FULL, {} DROPPED SO FAR", ndev_,
+                                      tx_->stats.drops);
+                }
+                tx_->stats.depth_max = std::max<uint64_t>(tx_->stats.depth_max, tx_->skbs.size());
+
+                drain = !tx_->skbs.empty() && !std::exchange(tx_->drain_pending, true);
+        }
+
+        // one wakeup of the other end for whatever it has not picked up yet
+        if (drain) post_drain(tx_);
+
+        return nframes;
+}
+
+}  // namespace mstack
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include "device_engine.hpp"
+#include "queue_limit.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  One end of an in-memory link. Frames sent on one end are received on the
+ *  other one without a syscall, so two netns of the same process can be wired
+ *  back to back with no root and no /dev/net/tun. Frames keep their partial
+ *  checksums and GSO sizes on the way, the way they would over a veth pair.
+ *
+ *  Ends sharing an io_context hand frames over as they are. Ends running on
+ *  different io_contexts (and threads) copy them out of the pool of the
+ *  sending netns, pools are not thread-safe.
+ *
+ *  No more frames than the limit of the link wait for the other end to take
+ *  them. Once it is reached a sender keeps what is left in its TX queue, which
+ *  backs up to TCP, or makes room by dropping the oldest frames on the link,
+ *  depending on the drop policy. An end whose device pauses receiving leaves
+ *  the frames on the link until it is full, then takes them all the same: two
+ *  ends pausing for each other would never go on.
+ */
+class link_engine : public device_engine {
+public:
+        using end_pair = std::pair<std::unique_ptr<link_engine>, std::unique_ptr<link_engine>>;
+
+        /**
+         *  Two connected ends named @name_a and @name_b running on @io_ctx_a and
+         *  @io_ctx_b, each direction holding up to @limit frames
+         */
+        static end_pair make_pair(boost::asio::io_context& io_ctx_a,
+                                  std::string_view         name_a,
+                                  boost::asio::io_context& io_ctx_b,
+                                  std::string_view         name_b,
+                                  queue_limit              limit = {});
+
+        ~link_engine() noexcept override;
+
+        std::string const& name() const override;
+
+        uint32_t offloads() const override;
+
+        size_t mtu() const override;
+        void   set_mtu(size_t mtu) override;
+
+        void start(device& dev) override;
+
+        size_t transmit(std::queue<skbuff>& skbs) override;
+
+        void resume_rx() override;
+
+private:
+        // one direction of the link, from the end that sends to the one that
+        // receives
+        struct wire;
+
+        explicit link_engine(std::string_view      name,
+                             std::shared_ptr<wire> rx,
+                             std::shared_ptr<wire> tx);
+
+        static void post_drain(std::shared_ptr<wire> const& w);
+
+        static void post_resume(std::shared_ptr<wire> const& w);
+
+        void receive_batch();
+
+        std::string           ndev_;
+        device*               dev_{nullptr};
+        size_t                mtu_;
+        std::shared_ptr<wire> rx_;
+        std::shared_ptr<wire> tx_;
+        std::vector<skbuff>   in_skbs_;
+};
+
+}  // namespace mstack
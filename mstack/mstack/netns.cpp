@@ -9,9 +9,11 @@
 #include "ipv4.hpp"
 #include "neigh_cache.hpp"
 #include "routing_table.hpp"
+#include "skb_pool.hpp"
 #include "skbuff.hpp"
 #include "tcb_manager.hpp"
 #include "tcp.hpp"
+#include "timer_wheel.hpp"
 
 namespace mstack {
 
@@ -27,35 +29,43 @@ public:
         impl& operator=(impl&&) = delete;
 
         ethernetv2&    eth() noexcept { return eth_; }
+        class arp&     arp() noexcept { return arp_; }
         neigh_cache&   neighs() noexcept { return *neighs_; }
         routing_table& rt() noexcept { return *rt_; }
         ipv4&          ip() noexcept { return ipv4_; }
         class tcp&     tcp() noexcept { return tcp_; }
         tcb_manager&   tcb_m() noexcept { return tcb_m_; }
+        skb_pool&      pool() noexcept { return *pool_; }
+        timer_wheel&   timers() noexcept { return timers_; }
 
         boost::asio::io_context& io_context_execution() { return io_ctx_; }
 
 private:
         boost::asio::io_context& io_ctx_;
 
+        std::shared_ptr<skb_pool>      pool_;
+        std::shared_ptr<routing_table> rt_;
+        // outlives the connections of tcb_m_, whose timers it holds
+        timer_wheel                    timers_;
         tcb_manager                    tcb_m_;
         class tcp                      tcp_;
         icmp                           icmp_;
         std::shared_ptr<neigh_cache>   neighs_;
-        arp                            arp_;
-        std::shared_ptr<routing_table> rt_;
+        class arp                      arp_;
         ipv4                           ipv4_;
         ethernetv2                     eth_;
 };
 
 netns::impl::impl(boost::asio::io_context& io_ctx)
     : io_ctx_(io_ctx),
-      tcb_m_(io_ctx_),
+      pool_(std::make_shared<skb_pool>()),
+      rt_(std::make_shared<routing_table>()),
+      timers_(io_ctx_),
+      tcb_m_(io_ctx_, pool_, rt_, timers_),
       tcp_(io_ctx_),
       icmp_(io_ctx_),
       neighs_(std::make_shared<neigh_cache>()),
-      arp_(io_ctx_, neighs_),
-      rt_(std::make_shared<routing_table>()),
+      arp_(io_ctx_, neighs_, pool_),
       ipv4_(io_ctx_, rt_, neighs_, arp_),
       eth_(io_ctx_) {
         tcb_m_.under_proto_update(tcp_);
@@ -78,11 +88,14 @@ netns::netns(boost::asio::io_context& io_ctx) : pimpl_(std::make_unique<impl>(io
 netns::~netns() noexcept = default;
 
 ethernetv2&    netns::eth() noexcept { return pimpl_->eth(); }
+class arp&     netns::arp() noexcept { return pimpl_->arp(); }
 neigh_cache&   netns::neighs() noexcept { return pimpl_->neighs(); }
 routing_table& netns::rt() noexcept { return pimpl_->rt(); }
 ipv4&          netns::ip() noexcept { return pimpl_->ip(); }
 class tcp&     netns::tcp() noexcept { return pimpl_->tcp(); }
 tcb_manager&   netns::tcb_m() noexcept { return pimpl_->tcb_m(); }
+skb_pool&      netns::pool() noexcept { return pimpl_->pool(); }
+timer_wheel&   netns::timers() noexcept { return pimpl_->timers(); }
 
 boost::asio::io_context& netns::io_context_execution() noexcept {
         assert(pimpl_);
@@ -8,11 +8,15 @@
 #include "ipv4.hpp"
 #include "neigh_cache.hpp"
 #include "routing_table.hpp"
+#include "skb_pool.hpp"
 #include "tcb_manager.hpp"
 #include "tcp.hpp"
+#include "timer_wheel.hpp"
 
 namespace mstack {
 
+class arp;
+
 class netns {
 public:
         static netns& _default_() {
@@ -33,11 +37,14 @@ public:
         netns& operator=(netns&&) = delete;
 
         ethernetv2&    eth() noexcept;
+        class arp&     arp() noexcept;
         neigh_cache&   neighs() noexcept;
         routing_table& rt() noexcept;
         ipv4&          ip() noexcept;
         class tcp&     tcp() noexcept;
         tcb_manager&   tcb_m() noexcept;
+        skb_pool&      pool() noexcept;
+        timer_wheel&   timers() noexcept;
 
         boost::asio::io_context& io_context_execution() noexcept;
 
@@ -0,0 +1,226 @@
+#include "netns_group.hpp"
+
+#include <cassert>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <boost/asio/post.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include "arp.hpp"
+#include "tcb_manager.hpp"
+#include "tcp_packet.hpp"
+#include "trace.hpp"
+
+namespace mstack {
+
+netns_group::netns_group(size_t nshards) {
+        assert(nshards > 0);
+
+        shards_.reserve(nshards);
+        for (size_t i{0}; i < nshards; ++i) {
+                auto s{std::make_unique<shard_ctx>()};
+                s->net = std::make_unique<netns>(s->io_ctx);
+                for (size_t from{0}; from < nshards; ++from) {
+                        s->segs_in.push_back(
+                                std::make_unique<spsc_ring<handoff>>(kSegmentRing));
+                        s->segs_over.push_back(std::make_unique<overflow>());
+                }
+                s->bell = std::make_unique<doorbell>(
+                        s->io_ctx, [this, p = s.get()] { return drain(*p); },
+                        [p = s.get()] { return pending(*p); });
+                shards_.push_back(std::move(s));
+        }
+
+        for (size_t i{0}; i < nshards; ++i) {
+                shards_[i]->net->tcb_m().set_shards({
+                        .self      = i,
+                        .count     = nshards,
+                        .forward   = [this, i](size_t to, tcp_packet&& pkt_in) {
+                                forward(i, to, {.pkt = std::move(pkt_in), .tcb = {}});
+                        },
+                        .hand_over = [this, i](size_t to, std::shared_ptr<tcb_t> tcb) {
+                                forward(i, to, {.pkt = {}, .tcb = std::move(tcb)});
+                        },
+                        .submit    = [this](size_t to, task fn) { submit(to, std::move(fn)); },
+                        .peer = [this](size_t j) -> tcb_manager& { return shard(j).tcb_m(); },
+                        .forward_backlogged = [this, i] {
+                                return std::ranges::any_of(shards_, [i](auto const& s) {
+                                        return s->segs_over[i]->pending.load(
+                                                std::memory_order_acquire);
+                                });
+                        },
+                });
+
+                // an ARP reply reaches the queue the kernel picks, not the shard
+                // that asked, so every shard learns what one does
+                shards_[i]->net->arp().on_learn(
+                        [this, i](mac_addr_t const& mac, ipv4_addr_t const& ipv4) {
+                                for (size_t j{0}; j < shards_.size(); ++j) {
+                                        if (j == i) continue;
+                                        submit(j, [net = &shard(j), mac, ipv4] {
+                                                net->arp().learn(mac, ipv4);
+                                        });
+                                }
+                        });
+        }
+}
+
+netns_group::~netns_group() noexcept { stop(); }
+
+size_t netns_group::size() const { return shards_.size(); }
+
+netns& netns_group::shard(size_t i) {
+        assert(i < shards_.size());
+        return *shards_[i]->net;
+}
+
+netns& netns_group::owner(two_ends_t const& two_end) {
+        return shard(flow_shard(two_end, shards_.size()));
+}
+
+std::vector<std::reference_wrapper<netns>> netns_group::nets() {
+        std::vector<std::reference_wrapper<netns>> nets;
+        nets.reserve(shards_.size());
+        for (auto& s : shards_)
+                nets.emplace_back(*s->net);
+        return nets;
+}
+
+void netns_group::run(bool pin_cpus /* = false*/) {
+        for (size_t i{0}; i < shards_.size(); ++i) {
+                auto& s{*shards_[i]};
+                if (s.thread.joinable()) continue;
+
+                s.io_ctx.restart();
+                s.work.emplace(s.io_ctx.get_executor());
+                s.thread = std::thread{[&s] {
+#ifdef MSTACK_TRACE
+                        // before the first packet, tracing then never allocates
+                        trace::attach();
+#endif
+                        s.net->tcb_m().bind_this_thread();
+                        s.io_ctx.run();
+                }};
+
+                if (pin_cpus) {
+                        cpu_set_t cpus;
+                        CPU_ZERO(&cpus);
+                        CPU_SET(i, &cpus);
+                        if (auto const err{::pthread_setaffinity_np(s.thread.native_handle(),
+                                                                    sizeof(cpus), &cpus)})
+                                spdlog::warn("[NETNS GROUP] PIN SHARD {} TO CPU {} FAIL {}", i, i,
+                                             err);
+                }
+        }
+
+        spdlog::info("[NETNS GROUP] RUN {} SHARDS", shards_.size());
+}
+
+void netns_group::stop() {
+        for (auto& s : shards_) {
+                s->work.reset();
+                s->io_ctx.stop();
+        }
+        for (auto& s : shards_)
+                if (s->thread.joinable()) s->thread.join();
+}
+
+void netns_group::submit(size_t to, task fn) {
+        assert(to < shards_.size());
+        auto& s{*shards_[to]};
+
+        if (s.tasks_in.try_push(std::move(fn))) {
+                s.bell->ring();
+        } else {
+                boost::asio::post(s.io_ctx, std::move(fn));
+        }
+}
+
+void netns_group::forward(size_t from, size_t to, handoff&& msg) {
+        assert(to < shards_.size());
+        auto& s{*shards_[to]};
+
+        auto& ring{*s.segs_in[from]};
+        auto& over{*s.segs_over[from]};
+
+        // only this thread sets pending, and the owner clears it once it has
+        // taken all there was
+        if (!over.pending.load(std::memory_order_acquire) && ring.try_push(std::move(msg))) {
+                s.bell->ring();
+                return;
+        }
+
+        {
+                // a connection moving over must not be overtaken by its segments,
+                // nor the other way round, so nothing goes past the overflow
+                std::lock_guard lock{over.mtx};
+                if (!over.msgs.empty() || !ring.try_push(std::move(msg))) {
+                        over.msgs.push_back(std::move(msg));
+                        over.pending.store(true, std::memory_order_release);
+                }
+        }
+        s.bell->ring();
+}
+
+void netns_group::receive(shard_ctx& s, size_t from, handoff&& msg) {
+        if (msg.tcb) {
+                s.net->tcb_m().adopt(std::move(msg.tcb));
+        } else {
+                s.net->tcb_m().process_forwarded(std::move(msg.pkt), from);
+        }
+}
+
+bool netns_group::drain(shard_ctx& s) {
+        bool left{false};
+
+        for (size_t from{0}; from < s.segs_in.size(); ++from) {
+                auto const n{s.segs_in[from]->drain(
+                        [&s, from](handoff&& msg) { receive(s, from, std::move(msg)); },
+                        kDrainBudget)};
+                left = left || !(n < kDrainBudget) || !drain_overflow(s, from);
+        }
+
+        auto const n{s.tasks_in.drain([](task&& fn) { fn(); }, kDrainBudget)};
+        return left || !(n < kDrainBudget);
+}
+
+bool netns_group::drain_overflow(shard_ctx& s, size_t from) {
+        auto& over{*s.segs_over[from]};
+        if (!over.pending.load(std::memory_order_acquire)) return true;
+
+        std::deque<handoff> msgs;
+        {
+                // what is in the ring went in before anything here
+                std::lock_guard lock{over.mtx};
+                if (!s.segs_in[from]->empty()) return false;
+                msgs.swap(over.msgs);
+                over.pending.store(false, std::memory_order_release);
+        }
+
+        // shard @from may have stopped receiving until now
+        submit(from, [net = shards_[from]->net.get()] { net->tcb_m().resume_rx(); });
+
+        // ahead of whatever the ring takes from now on
+        for (auto& msg : msgs)
+                receive(s, from, std::move(msg));
+        return true;
+}
+
+bool netns_group::pending(shard_ctx const& s) {
+        return !s.tasks_in.empty() ||
+               std::ranges::any_of(s.segs_in, [](auto const& ring) { return !ring->empty(); }) ||
+               std::ranges::any_of(s.segs_over, [](auto const& over) {
+                       return over->pending.load(std::memory_order_acquire);
+               });
+}
+
+}  // namespace mstack
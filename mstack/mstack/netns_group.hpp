@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include "channel.hpp"
+#include "tcb.hpp"
+#include "netns.hpp"
+#include "packets.hpp"
+#include "tcp_packet.hpp"
+
+namespace mstack {
+
+/**
+ *  A stack sharded across threads: one netns per shard, each with its own
+ *  io_context, tcb_manager, connection table and buffer pool, and each run by
+ *  a thread of its own. A connection belongs to the shard flow_shard() picks
+ *  for its two ends and only that shard ever touches it.
+ *
+ *  Give every shard a queue of the same interface with
+ *  device::create_multi_queue(nets()), then RX and TX of a connection stay on
+ *  its shard: segments the kernel hands to another queue are forwarded to the
+ *  owner, which sends on its own queue, and TAP steers the flow to that queue
+ *  from then on. Neighbours one shard learns are passed on to all others, an
+ *  ARP reply may come in on any queue. Routes, addresses and acceptors are
+ *  set up on every shard.
+ *
+ *  A connection follows the application: once its socket is used from the
+ *  thread of another shard, it moves there with its next segment (receive
+ *  flow steering), see tcb_t::steer_here().
+ *
+ *  Shards talk through lock-free rings rather than posting to each other:
+ *  one single-producer ring per pair of shards for forwarded segments, one
+ *  multi-producer ring per shard for submitted work, and a doorbell per shard
+ *  posting a single drain for whatever piled up meanwhile. A shard whose
+ *  segments no longer fit the ring of the owner has its devices stop
+ *  receiving until the owner has caught up.
+ */
+class netns_group {
+public:
+        static constexpr size_t kSegmentRing{1024};
+        static constexpr size_t kTaskRing{4096};
+        // messages a shard takes from each ring before letting its own
+        // packets through
+        static constexpr size_t kDrainBudget{256};
+
+        explicit netns_group(size_t nshards = std::max(1u, std::thread::hardware_concurrency()));
+        ~netns_group() noexcept;
+
+        netns_group(netns_group const&)            = delete;
+        netns_group& operator=(netns_group const&) = delete;
+
+        netns_group(netns_group&&)            = delete;
+        netns_group& operator=(netns_group&&) = delete;
+
+        size_t size() const;
+
+        netns& shard(size_t i);
+
+        /**
+         *  The shard owning the connection @two_end
+         */
+        netns& owner(two_ends_t const& two_end);
+
+        std::vector<std::reference_wrapper<netns>> nets();
+
+        /**
+         *  Runs @fn on the thread of shard @to, from any thread
+         */
+        void submit(size_t to, task fn);
+
+        /**
+         *  Starts one thread per shard running its io_context, the thread of
+         *  shard i pinned to CPU i if @pin_cpus
+         */
+        void run(bool pin_cpus = false);
+
+        /**
+         *  Has the threads return as soon as possible and waits for them
+         */
+        void stop();
+
+private:
+        // a segment, or a connection moving over along with its segments
+        struct handoff {
+                tcp_packet             pkt;
+                std::shared_ptr<tcb_t> tcb;
+        };
+
+        // what shard i forwards once its ring is full, in order: shard i appends
+        // here instead of to the ring while it is not empty, and the owner only
+        // takes it over once it has emptied the ring
+        struct overflow {
+                std::mutex          mtx;
+                std::deque<handoff> msgs;
+                std::atomic<bool>   pending{false};
+        };
+
+        struct shard_ctx {
+                boost::asio::io_context io_ctx;
+                std::optional<boost::asio::executor_work_guard<
+                        boost::asio::io_context::executor_type>>
+                                       work;
+                std::unique_ptr<netns> net;
+                // what shard i forwards waits in segs_in[i]
+                std::vector<std::unique_ptr<spsc_ring<handoff>>> segs_in;
+                std::vector<std::unique_ptr<overflow>>           segs_over;
+                mpsc_ring<task>                                  tasks_in{kTaskRing};
+                std::unique_ptr<doorbell>                        bell;
+                std::thread                                      thread;
+        };
+
+        void forward(size_t from, size_t to, handoff&& msg);
+
+        static void receive(shard_ctx& s, size_t from, handoff&& msg);
+
+        bool drain(shard_ctx& s);
+
+        /**
+         *  Takes over what shard @from could not fit into its ring, once the
+         *  ring is empty. false if the ring is not yet.
+         */
+        bool drain_overflow(shard_ctx& s, size_t from);
+
+        static bool pending(shard_ctx const& s);
+
+        std::vector<std::unique_ptr<shard_ctx>> shards_;
+};
+
+}  // namespace mstack
@@ -0,0 +1,38 @@
+#include "newreno.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "tcb.hpp"
+
+namespace mstack {
+
+std::string const& newreno::name() const {
+        static std::string const kName{"newreno"};
+        return kName;
+}
+
+void newreno::on_ack(send& snd, uint32_t acked) {
+        acked = slow_start(snd, acked);
+        if (0 == acked) return;
+
+        // RFC 5681 3.1, cwnd += SMSS once a whole cwnd has been acknowledged
+        bytes_acked_ += acked;
+        if (!(bytes_acked_ < snd.state.cwnd)) {
+                bytes_acked_ -= snd.state.cwnd;
+                snd.state.cwnd += snd.state.mss;
+        }
+}
+
+void newreno::on_loss(send& snd) {
+        // RFC 5681 (4)
+        snd.state.ssthresh = std::max<uint32_t>(in_flight(snd) / 2, 2 * snd.state.mss);
+        bytes_acked_       = 0;
+}
+
+void newreno::on_rto(send& snd) {
+        congestion_control::on_rto(snd);
+        bytes_acked_ = 0;
+}
+
+}  // namespace mstack
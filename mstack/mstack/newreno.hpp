@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+
+#include "congestion_control.hpp"
+
+namespace mstack {
+
+/**
+ *  RFC 5681 congestion avoidance: one segment more per window acknowledged,
+ *  counted in bytes, and half of the flight size once a loss is detected
+ */
+class newreno : public congestion_control {
+public:
+        newreno() = default;
+        ~newreno() override = default;
+
+        std::string const& name() const override;
+
+        void on_ack(send& snd, uint32_t acked) override;
+
+        void on_loss(send& snd) override;
+
+        void on_rto(send& snd) override;
+
+private:
+        // acknowledged since cwnd last grew in congestion avoidance
+        uint32_t bytes_acked_{0};
+};
+
+}  // namespace mstack
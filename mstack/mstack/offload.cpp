@@ -0,0 +1,120 @@
+#include "offload.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <utility>
+
+#include "ethernet_header.hpp"
+#include "ipv4_header.hpp"
+#include "tcp_header.hpp"
+#include "utils.hpp"
+
+namespace mstack {
+
+uint16_t pseudo_header_sum(ipv4_addr_t src_addrv4,
+                           ipv4_addr_t dst_addrv4,
+                           uint8_t     proto,
+                           uint16_t    len) {
+        struct pseudo_header {
+                uint32_t src_addrv4;
+                uint32_t dst_addrv4;
+                uint8_t  reserved;
+                uint8_t  proto;
+                uint16_t segment_len;
+        } const ph_net = {
+                .src_addrv4  = utils::hton(src_addrv4.raw()),
+                .dst_addrv4  = utils::hton(dst_addrv4.raw()),
+                .reserved    = 0,
+                .proto       = proto,
+                .segment_len = utils::hton(len),
+        };
+
+        return utils::fold(utils::sum_every_16bits(
+                {reinterpret_cast<std::byte const*>(&ph_net), sizeof(ph_net)}));
+}
+
+void csum_help(skbuff& skb) {
+        auto& offload{skb.offload()};
+        if (!offload.csum_partial) return;
+
+        assert(!(offload.csum_start < skb.headroom()));
+
+        auto* const start{skb.head() - skb.headroom() + offload.csum_start};
+        assert(!(start + offload.csum_offset + sizeof(uint16_t) > skb.tail()));
+
+        uint16_t const chsum_net{utils::checksum({start, skb.tail()})};
+        std::memcpy(start + offload.csum_offset, &chsum_net, sizeof(chsum_net));
+
+        offload.csum_partial = false;
+}
+
+std::vector<skbuff> gso_segment(skbuff&& skb, skb_pool& pool) {
+        auto const mss{skb.offload().gso_size};
+        assert(mss > 0);
+
+        auto* const eth{skb.head()};
+        auto* const iph{eth + ethernetv2_header_t::size()};
+        auto        ipv4h{ipv4_header_t::consume_from_net(iph)};
+        auto* const tcph{iph + (ipv4h.hlen << 2)};
+        auto        tcph_fixed{tcp_header_t::consume_from_net(tcph)};
+
+        auto const hdrs_len{static_cast<size_t>(tcph - eth) + (tcph_fixed.data_offset << 2)};
+        assert(!(skb.payload().size() < hdrs_len));
+
+        auto const data{skb.payload().subspan(hdrs_len)};
+        auto const seq_no{tcph_fixed.seq_no};
+        auto const id{ipv4h.id};
+        auto const fin{tcph_fixed.FIN};
+        auto const psh{tcph_fixed.PSH};
+
+        std::vector<skbuff> segs;
+        segs.reserve((data.size() + mss - 1) / mss);
+
+        for (size_t off{0}; off < data.size(); off += mss) {
+                auto const seg_len{std::min<size_t>(mss, data.size() - off)};
+                bool const last{!(off + seg_len < data.size())};
+
+                auto seg{skbuff{pool, hdrs_len + seg_len}};
+                std::ranges::copy(skb.payload().first(hdrs_len), seg.head());
+                std::ranges::copy(data.subspan(off, seg_len), seg.head() + hdrs_len);
+
+                auto* const seg_iph{seg.head() + (iph - eth)};
+                auto* const seg_tcph{seg.head() + (tcph - eth)};
+                auto const  tcp_len{static_cast<uint16_t>(hdrs_len - (tcph - eth) + seg_len)};
+
+                ipv4h.total_length = static_cast<uint16_t>((tcph - iph) + tcp_len);
+                ipv4h.id           = static_cast<uint16_t>(id + segs.size());
+                ipv4h.header_chsum = 0;
+                ipv4h.produce_to_net(seg_iph);
+
+                uint16_t const header_chsum_net{
+                        utils::checksum({seg_iph, ipv4_header_t::fixed_size()}),
+                };
+                std::memcpy(seg_iph + offsetof(ipv4_header_t, header_chsum), &header_chsum_net,
+                            sizeof(header_chsum_net));
+
+                tcph_fixed.seq_no = seq_no + static_cast<uint32_t>(off);
+                tcph_fixed.CWR    = segs.empty() ? tcph_fixed.CWR : 0;
+                tcph_fixed.FIN    = last ? fin : 0;
+                tcph_fixed.PSH    = last ? psh : 0;
+                tcph_fixed.chsum  = utils::ntoh(pseudo_header_sum(ipv4h.src_addr, ipv4h.dst_addr,
+                                                                  ipv4h.proto_type, tcp_len));
+                tcph_fixed.produce_to_net(seg_tcph);
+
+                seg.offload() = {
+                        .csum_partial = true,
+                        .csum_start   = static_cast<uint16_t>(seg_tcph - seg.head()),
+                        .csum_offset  = offsetof(tcp_header_t, chsum),
+                        .gso_size     = 0,
+                };
+
+                segs.push_back(std::move(seg));
+        }
+
+        return segs;
+}
+
+}  // namespace mstack
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "ipv4_addr.hpp"
+#include "skb_pool.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  Offloads a device engine takes care of for outgoing frames
+ */
+enum : uint32_t {
+        kOffloadCsum = 1u << 0,
+        kOffloadTSO4 = 1u << 1,
+        // frames with fragments are sent without being linearized first
+        kOffloadSG = 1u << 2,
+};
+
+/**
+ *  Folded, not yet complemented sum of the IPv4 pseudo header, the seed a partial
+ *  transport checksum starts with
+ */
+uint16_t pseudo_header_sum(ipv4_addr_t src_addrv4,
+                           ipv4_addr_t dst_addrv4,
+                           uint8_t     proto,
+                           uint16_t    len);
+
+/**
+ *  Software fallback for kOffloadCsum: completes the partial checksum of @skb
+ */
+void csum_help(skbuff& skb);
+
+/**
+ *  Software fallback for kOffloadTSO4: splits the ethernet frame @skb carrying a
+ *  TCP over IPv4 GSO segment into frames of at most gso_size bytes of payload.
+ *  The checksums of the frames produced are left partial.
+ */
+std::vector<skbuff> gso_segment(skbuff&& skb, skb_pool& pool);
+
+}  // namespace mstack
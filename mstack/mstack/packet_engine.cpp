@@ -0,0 +1,252 @@
+#include "packet_engine.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <span>
+#include <stdexcept>
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <spdlog/spdlog.h>
+
+#include "device.hpp"
+#include "ethernet_header.hpp"
+#include "skbuff.hpp"
+#include "utils.hpp"
+
+namespace mstack {
+
+namespace {
+
+// where a frame starts in a TX ring slot unless PACKET_TX_HAS_OFF says otherwise
+constexpr size_t kTxDataOffset{TPACKET3_HDRLEN - sizeof(sockaddr_ll)};
+
+template <typename T>
+void set_option(int fd, int opt, T const& value, std::string_view what) {
+        if (::setsockopt(fd, SOL_PACKET, opt, &value, sizeof(value)) < 0)
+                throw std::runtime_error{std::format("[PACKET] {} FAIL {}", what, strerror(errno))};
+}
+
+}  // namespace
+
+packet_engine::packet_engine(boost::asio::io_context& io_ctx,
+                             skb_pool&                pool,
+                             std::string_view         name,
+                             bool                     fanout /* = false*/)
+    : sfd_(io_ctx),
+      pool_(pool),
+      ndev_(name),
+      tx_frame_size_(std::bit_ceil(kTxDataOffset + ethernetv2_header_t::size() +
+                                   std::clamp(if_mtu(name), device::kMtuDefault,
+                                              device::kMtuMax))),
+      tx_frames_(kBlockSize * kTxBlocks / tx_frame_size_) {
+        auto const fd{::socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               utils::hton<uint16_t>(ETH_P_ALL))};
+        if (fd < 0)
+                throw std::runtime_error{std::format("[PACKET] SOCKET FAIL {}", strerror(errno))};
+        sfd_.assign(fd);
+
+        auto const ifindex{::if_nametoindex(ndev_.c_str())};
+        if (0 == ifindex)
+                throw std::runtime_error{
+                        std::format("[PACKET] NO DEV {} {}", ndev_, strerror(errno))};
+
+        set_option(fd, PACKET_VERSION, int{TPACKET_V3}, "VERSION");
+
+        // our own frames would be looped back to the RX ring otherwise, they are
+        // filtered out by packet type below if the kernel is too old for this
+        if (int const on{1};
+            ::setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on)) < 0)
+                spdlog::warn("[PACKET] IGNORE OUTGOING FAIL {}", strerror(errno));
+
+        set_option(fd, PACKET_QDISC_BYPASS, int{1}, "QDISC BYPASS");
+
+        set_option(fd, PACKET_RX_RING,
+                   tpacket_req3{
+                           .tp_block_size       = kBlockSize,
+                           .tp_block_nr         = kRxBlocks,
+                           .tp_frame_size       = kRxFrameSize,
+                           .tp_frame_nr         = kBlockSize / kRxFrameSize * kRxBlocks,
+                           .tp_retire_blk_tov   = kBlockTimeoutMs,
+                           .tp_sizeof_priv      = 0,
+                           .tp_feature_req_word = 0,
+                   },
+                   "RX RING");
+
+        set_option(fd, PACKET_TX_RING,
+                   tpacket_req3{
+                           .tp_block_size       = kBlockSize,
+                           .tp_block_nr         = kTxBlocks,
+                           .tp_frame_size       = static_cast<unsigned>(tx_frame_size_),
+                           .tp_frame_nr         = static_cast<unsigned>(tx_frames_),
+                           .tp_retire_blk_tov   = 0,
+                           .tp_sizeof_priv      = 0,
+                           .tp_feature_req_word = 0,
+                   },
+                   "TX RING");
+
+        sockaddr_ll sll{};
+        sll.sll_family   = AF_PACKET;
+        sll.sll_protocol = utils::hton<uint16_t>(ETH_P_ALL);
+        sll.sll_ifindex  = static_cast<int>(ifindex);
+        if (::bind(fd, reinterpret_cast<sockaddr const*>(&sll), sizeof(sll)) < 0)
+                throw std::runtime_error{
+                        std::format("[PACKET] BIND {} FAIL {}", ndev_, strerror(errno))};
+
+        if (fanout)
+                set_option(fd, PACKET_FANOUT,
+                           static_cast<int>((ifindex & 0xffff) | PACKET_FANOUT_HASH << 16),
+                           "FANOUT");
+
+        // both rings come in a single mapping, the RX one first
+        ring_sz_ = kBlockSize * (kRxBlocks + kTxBlocks);
+        auto* const ring{::mmap(nullptr, ring_sz_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd, 0)};
+        if (MAP_FAILED == ring)
+                throw std::runtime_error{std::format("[PACKET] RING MAP FAIL {}", strerror(errno))};
+        ring_    = static_cast<std::byte*>(ring);
+        tx_ring_ = ring_ + kBlockSize * kRxBlocks;
+}
+
+packet_engine::~packet_engine() noexcept { ::munmap(ring_, ring_sz_); }
+
+std::string const& packet_engine::name() const { return ndev_; }
+
+size_t packet_engine::mtu_max() const {
+        return tx_frame_size_ - kTxDataOffset - ethernetv2_header_t::size();
+}
+
+void packet_engine::start(device& dev) {
+        dev_ = &dev;
+        async_receive();
+}
+
+void packet_engine::async_receive() {
+        sfd_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                        [this](boost::system::error_code const& ec) {
+                                if (ec) {
+                                        spdlog::warn("[DEV {}] RECEIVE FAIL {}", ndev_, ec.what());
+                                        async_receive();
+                                        return;
+                                }
+                                receive_blocks();
+                                if (pause_rx(*dev_)) return;
+                                async_receive();
+                        });
+}
+
+void packet_engine::resume_rx() { async_receive(); }
+
+void packet_engine::receive_blocks() {
+        assert(dev_);
+        assert(in_skbs_.empty());
+
+        for (;;) {
+                auto* const block{
+                        reinterpret_cast<tpacket_block_desc*>(ring_ + rx_block_ * kBlockSize)};
+                std::atomic_ref<uint32_t> status{block->hdr.bh1.block_status};
+                if (!(status.load(std::memory_order_acquire) & TP_STATUS_USER)) break;
+
+                auto* frame{reinterpret_cast<std::byte*>(block) +
+                            block->hdr.bh1.offset_to_first_pkt};
+                for (uint32_t i{0}; i < block->hdr.bh1.num_pkts; ++i) {
+                        auto const* hdr{reinterpret_cast<tpacket3_hdr const*>(frame)};
+                        auto const* sll{reinterpret_cast<sockaddr_ll const*>(
+                                frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)))};
+                        if (PACKET_OUTGOING != sll->sll_pkttype) {
+                                auto skb{skbuff{pool_, hdr->tp_snaplen}};
+                                std::memcpy(skb.head(), frame + hdr->tp_mac, hdr->tp_snaplen);
+                                in_skbs_.push_back(std::move(skb));
+                        }
+                        frame += hdr->tp_next_offset;
+                }
+
+                // the block goes back to the kernel before the frames go up the
+                // stack, they have been copied out already
+                status.store(TP_STATUS_KERNEL, std::memory_order_release);
+                rx_block_ = (rx_block_ + 1) % kRxBlocks;
+
+                for (std::span<skbuff> skbs{in_skbs_}; !skbs.empty();) {
+                        auto const n{std::min(skbs.size(), dev_->rx_batch())};
+                        deliver(*dev_, skbs.first(n));
+                        skbs = skbs.subspan(n);
+                }
+                in_skbs_.clear();
+        }
+}
+
+void packet_engine::async_wait_tx() {
+        tx_blocked_ = true;
+        sfd_.async_wait(boost::asio::posix::stream_descriptor::wait_write,
+                        [this](boost::system::error_code const& ec) {
+                                if (ec) spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_, ec.what());
+                                tx_blocked_ = false;
+                                resume_tx(*dev_);
+                        });
+}
+
+size_t packet_engine::transmit(std::queue<skbuff>& skbs) {
+        assert(dev_);
+
+        if (tx_blocked_) return 0;
+
+        size_t nframes{0};
+
+        while (!skbs.empty()) {
+                auto* const frame{tx_ring_ + tx_frame_ * tx_frame_size_};
+                auto* const hdr{reinterpret_cast<tpacket3_hdr*>(frame)};
+
+                std::atomic_ref<uint32_t> status{hdr->tp_status};
+                if (auto const st{status.load(std::memory_order_acquire)};
+                    st & TP_STATUS_WRONG_FORMAT) {
+                        ++stats(*dev_).tx_errors;
+                        spdlog::warn("[DEV {}] WRITE FAIL MALFORMED FRAME", ndev_);
+                } else if (TP_STATUS_AVAILABLE != st) {
+                        // the ring is full, the kernel has not sent out this slot yet
+                        break;
+                }
+
+                auto const buf{skbs.front().payload()};
+                if (buf.size() > tx_frame_size_ - kTxDataOffset) {
+                        ++stats(*dev_).tx_errors;
+                        spdlog::warn("[DEV {}] WRITE FAIL FRAME {} TOO BIG", ndev_, buf.size());
+                        skbs.pop();
+                        continue;
+                }
+
+                std::ranges::copy(buf, frame + kTxDataOffset);
+                hdr->tp_len         = static_cast<uint32_t>(buf.size());
+                hdr->tp_next_offset = 0;
+                status.store(TP_STATUS_SEND_REQUEST, std::memory_order_release);
+
+                tx_frame_ = (tx_frame_ + 1) % tx_frames_;
+
+                ++nframes;
+                stats(*dev_).tx_bytes += buf.size();
+                skbs.pop();
+        }
+
+        // one kick for the whole batch, a full ring gets one too in case frames of
+        // an earlier kick are still waiting for it
+        if ((nframes > 0 || !skbs.empty()) &&
+            ::send(sfd_.native_handle(), nullptr, 0, MSG_DONTWAIT) < 0 && EAGAIN != errno &&
+            EWOULDBLOCK != errno)
+                spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_, strerror(errno));
+
+        if (!skbs.empty()) async_wait_tx();
+
+        stats(*dev_).tx_packets += nframes;
+
+        return nframes;
+}
+
+}  // namespace mstack
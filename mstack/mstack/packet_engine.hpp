@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "device_engine.hpp"
+#include "skb_pool.hpp"
+#include "skbuff.hpp"
+#include "size_literals.hpp"
+
+namespace mstack {
+
+/**
+ *  Attaches to an existing interface @name (a veth end, for instance) with an
+ *  AF_PACKET socket and TPACKET_V3 rings mapped into the process. Received
+ *  frames are taken block by block straight out of the RX ring, frames to send
+ *  are placed into the TX ring and the kernel is kicked once per flush, so no
+ *  syscall is made per packet in either direction. TX slots are sized after
+ *  the MTU the interface has when the engine attaches to it.
+ */
+class packet_engine : public device_engine {
+public:
+        static constexpr size_t kBlockSize{256_KiB};
+        static constexpr size_t kRxBlocks{16};
+        static constexpr size_t kTxBlocks{4};
+        // frames of a TPACKET_V3 RX block are packed back to back whatever their
+        // size, this only matters to the ring geometry
+        static constexpr size_t kRxFrameSize{2_KiB};
+        // a block is handed over to us when it has been open that long even if
+        // it is not full yet
+        static constexpr uint32_t kBlockTimeoutMs{1};
+
+        /**
+         *  With @fanout set the socket joins the PACKET_FANOUT_HASH group of the
+         *  interface, the kernel spreads flows across the sockets of the group
+         */
+        explicit packet_engine(boost::asio::io_context& io_ctx,
+                               skb_pool&                pool,
+                               std::string_view         name,
+                               bool                     fanout = false);
+        ~packet_engine() noexcept override;
+
+        std::string const& name() const override;
+
+        void start(device& dev) override;
+
+        size_t mtu_max() const override;
+
+        size_t transmit(std::queue<skbuff>& skbs) override;
+
+        void resume_rx() override;
+
+private:
+        void async_receive();
+
+        void receive_blocks();
+
+        void async_wait_tx();
+
+        boost::asio::posix::stream_descriptor sfd_;
+        skb_pool&                             pool_;
+        std::string                           ndev_;
+        device*                               dev_{nullptr};
+
+        std::byte* ring_{nullptr};
+        size_t     ring_sz_{0};
+        std::byte* tx_ring_{nullptr};
+        size_t     rx_block_{0};
+        size_t     tx_frame_{0};
+        size_t     tx_frame_size_;
+        size_t     tx_frames_;
+
+        std::vector<skbuff> in_skbs_;
+        bool                tx_blocked_{false};
+};
+
+}  // namespace mstack
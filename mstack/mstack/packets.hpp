@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
 
 #include <boost/container_hash/hash.hpp>
 
@@ -32,5 +34,19 @@ struct hash<mstack::two_ends_t> {
 }  // namespace std
 
 namespace mstack {
+
 inline size_t hash_value(two_ends_t const& v) { return std::hash<two_ends_t>{}(v); }
+
+/**
+ *  Which of @nshards shards owns the connection @two_ends, the same answer on
+ *  every shard
+ */
+inline size_t flow_shard(two_ends_t const& two_ends, size_t nshards) {
+        assert(nshards > 0);
+        // hash_combine leaves the low bits of nearby ports alike, the high bits
+        // of a multiplicative hash do not
+        auto const h{static_cast<uint64_t>(hash_value(two_ends)) * 0x9e3779b97f4a7c15};
+        return static_cast<size_t>((h >> 32) * nshards >> 32);
+}
+
 }  // namespace mstack
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mstack {
+
+enum class drop_policy : uint8_t {
+        // the packet arriving at a full queue is dropped
+        tail,
+        // the oldest packet in the queue makes room for the one arriving
+        head,
+};
+
+/**
+ *  How many packets a queue holds at most and which one gives way once it is
+ *  full
+ */
+struct queue_limit {
+        static constexpr size_t kDepthDefault{4096};
+
+        size_t      depth{kDepthDefault};
+        drop_policy policy{drop_policy::tail};
+};
+
+struct queue_stats {
+        uint64_t drops;
+        uint64_t depth_max;
+};
+
+}  // namespace mstack
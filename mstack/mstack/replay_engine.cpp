@@ -0,0 +1,336 @@
+#include "replay_engine.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <concepts>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "device.hpp"
+#include "offload.hpp"
+#include "skbuff.hpp"
+#include "utils.hpp"
+
+namespace mstack {
+
+namespace {
+
+constexpr uint32_t kPcapMagicUsec{0xa1b2c3d4};
+constexpr uint32_t kPcapMagicNsec{0xa1b23c4d};
+constexpr size_t   kPcapHeaderSize{24};
+constexpr size_t   kPcapRecordHeaderSize{16};
+
+constexpr uint32_t kPcapngSHB{0x0a0d0d0a};
+constexpr uint32_t kPcapngIDB{1};
+constexpr uint32_t kPcapngSPB{3};
+constexpr uint32_t kPcapngEPB{6};
+constexpr uint32_t kPcapngByteOrderMagic{0x1a2b3c4d};
+constexpr uint16_t kPcapngOptEnd{0};
+constexpr uint16_t kPcapngOptTsResol{9};
+
+constexpr uint32_t kLinkTypeEthernet{1};
+// default if_tsresol, microseconds
+constexpr uint8_t kTsResolUsec{6};
+
+template <std::integral T>
+T load(std::byte const* p, bool swap) {
+        T v;
+        std::memcpy(&v, p, sizeof(v));
+        return swap ? utils::detail::byteswap(v) : v;
+}
+
+constexpr size_t pad4(size_t n) { return (n + 3) & ~size_t{3}; }
+
+/**
+ *  @units of a pcapng if_tsresol @tsresol, 10^-n seconds or 2^-n with the top
+ *  bit set
+ */
+std::chrono::nanoseconds ts_of(uint64_t units, uint8_t tsresol) {
+        if (tsresol & 0x80)
+                return std::chrono::nanoseconds{static_cast<int64_t>(
+                        (static_cast<unsigned __int128>(units) * 1'000'000'000) >>
+                        (tsresol & 0x7f))};
+
+        auto scale{uint64_t{1}};
+        for (int n{tsresol}; n != 9; n += n < 9 ? 1 : -1)
+                scale *= 10;
+        return std::chrono::nanoseconds{
+                static_cast<int64_t>(tsresol < 9 ? units * scale : units / scale)};
+}
+
+}  // namespace
+
+replay_engine::replay_engine(boost::asio::io_context& io_ctx,
+                             skb_pool&                pool,
+                             std::string_view         path,
+                             replay_options           opts /* = {}*/)
+    : io_ctx_(io_ctx),
+      timer_(io_ctx),
+      pool_(pool),
+      ndev_(std::filesystem::path{path}.filename().string()),
+      opts_(std::move(opts)),
+      mtu_(device::kMtuDefault) {
+        auto const fd{::open(std::string{path}.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (fd < 0)
+                throw std::runtime_error{
+                        std::format("[REPLAY] OPEN {} FAIL {}", path, strerror(errno))};
+
+        struct stat st {};
+        if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(uint32_t))) {
+                ::close(fd);
+                throw std::runtime_error{std::format("[REPLAY] {} NOT A CAPTURE", path)};
+        }
+
+        map_sz_ = static_cast<size_t>(st.st_size);
+        auto* const map{::mmap(nullptr, map_sz_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)};
+        ::close(fd);
+        if (MAP_FAILED == map)
+                throw std::runtime_error{
+                        std::format("[REPLAY] MAP {} FAIL {}", path, strerror(errno))};
+        map_ = static_cast<std::byte*>(map);
+
+        try {
+                if (kPcapngSHB == load<uint32_t>(map_, false))
+                        index_pcapng();
+                else
+                        index_pcap();
+        } catch (...) {
+                ::munmap(map_, map_sz_);
+                throw;
+        }
+
+        if (frames_.empty()) spdlog::warn("[REPLAY] {} HAS NO ETHERNET FRAMES", path);
+
+        spdlog::info("[REPLAY] {} FRAMES {} SPEED {} LOOPS {}", path, frames_.size(),
+                     opts_.speed, opts_.loops);
+}
+
+replay_engine::~replay_engine() noexcept { ::munmap(map_, map_sz_); }
+
+void replay_engine::index_pcap() {
+        if (map_sz_ < kPcapHeaderSize)
+                throw std::runtime_error{std::format("[REPLAY] {} TRUNCATED", ndev_)};
+
+        auto const magic{load<uint32_t>(map_, false)};
+        bool const swap{utils::detail::byteswap(kPcapMagicUsec) == magic ||
+                        utils::detail::byteswap(kPcapMagicNsec) == magic};
+        bool const nsec{kPcapMagicNsec == load<uint32_t>(map_, swap)};
+        if (!nsec && kPcapMagicUsec != load<uint32_t>(map_, swap))
+                throw std::runtime_error{std::format("[REPLAY] {} NOT A CAPTURE", ndev_)};
+
+        // the top bits carry the FCS length, if any
+        if (kLinkTypeEthernet != (load<uint32_t>(map_ + 20, swap) & 0x0fffffff)) return;
+
+        for (size_t off{kPcapHeaderSize}; !(off + kPcapRecordHeaderSize > map_sz_);) {
+                auto const* rec{map_ + off};
+                auto const  sec{load<uint32_t>(rec, swap)};
+                auto const  frac{load<uint32_t>(rec + 4, swap)};
+                auto const  caplen{load<uint32_t>(rec + 8, swap)};
+
+                off += kPcapRecordHeaderSize;
+                if (off + caplen > map_sz_) break;
+
+                frames_.push_back({
+                        .data = {map_ + off, caplen},
+                        .ts   = std::chrono::seconds{sec} +
+                              std::chrono::nanoseconds{nsec ? frac : uint64_t{frac} * 1000},
+                });
+                off += caplen;
+        }
+}
+
+void replay_engine::index_pcapng() {
+        struct interface {
+                uint16_t linktype;
+                uint32_t snaplen;
+                uint8_t  tsresol;
+        };
+        std::vector<interface> ifaces;
+        bool                   swap{false};
+
+        for (size_t off{0}; !(off + 12 > map_sz_);) {
+                auto const* blk{map_ + off};
+
+                // a new section may come with its own byte order, the SHB type
+                // reads the same in both
+                if (kPcapngSHB == load<uint32_t>(blk, false)) {
+                        auto const bom{load<uint32_t>(blk + 8, false)};
+                        if (kPcapngByteOrderMagic != bom &&
+                            utils::detail::byteswap(kPcapngByteOrderMagic) != bom)
+                                throw std::runtime_error{
+                                        std::format("[REPLAY] {} BAD SECTION", ndev_)};
+                        swap = kPcapngByteOrderMagic != bom;
+                        ifaces.clear();
+                }
+
+                auto const type{load<uint32_t>(blk, swap)};
+                auto const len{load<uint32_t>(blk + 4, swap)};
+                if (len < 12 || 0 != (len & 3) || off + len > map_sz_) {
+                        spdlog::warn("[REPLAY] {} TRUNCATED AT {}", ndev_, off);
+                        break;
+                }
+                auto const body{std::span<std::byte const>{blk + 8, len - 12}};
+                off += len;
+
+                switch (type) {
+                        case kPcapngIDB: {
+                                if (body.size() < 8) break;
+                                auto iface{interface{
+                                        .linktype = load<uint16_t>(body.data(), swap),
+                                        .snaplen  = load<uint32_t>(body.data() + 4, swap),
+                                        .tsresol  = kTsResolUsec,
+                                }};
+                                for (auto opts{body.subspan(8)}; !(opts.size() < 4);) {
+                                        auto const code{load<uint16_t>(opts.data(), swap)};
+                                        auto const olen{load<uint16_t>(opts.data() + 2, swap)};
+                                        if (kPcapngOptEnd == code || size_t{4} + olen > opts.size())
+                                                break;
+                                        if (kPcapngOptTsResol == code && 1 == olen)
+                                                iface.tsresol = static_cast<uint8_t>(opts[4]);
+                                        opts = opts.subspan(std::min(opts.size(), 4 + pad4(olen)));
+                                }
+                                ifaces.push_back(iface);
+                        } break;
+                        case kPcapngEPB: {
+                                if (body.size() < 20) break;
+                                auto const id{load<uint32_t>(body.data(), swap)};
+                                if (!(id < ifaces.size()) ||
+                                    kLinkTypeEthernet != ifaces[id].linktype)
+                                        break;
+                                auto const units{
+                                        uint64_t{load<uint32_t>(body.data() + 4, swap)} << 32 |
+                                        load<uint32_t>(body.data() + 8, swap)};
+                                auto const caplen{load<uint32_t>(body.data() + 12, swap)};
+                                if (20 + caplen > body.size()) break;
+                                frames_.push_back({
+                                        .data = body.subspan(20, caplen),
+                                        .ts   = ts_of(units, ifaces[id].tsresol),
+                                });
+                        } break;
+                        case kPcapngSPB: {
+                                // no timestamp, replayed right after the frame before
+                                if (body.size() < 4 || ifaces.empty() ||
+                                    kLinkTypeEthernet != ifaces[0].linktype)
+                                        break;
+                                auto const origlen{load<uint32_t>(body.data(), swap)};
+                                auto const caplen{std::min<size_t>(
+                                        {origlen, body.size() - 4,
+                                         0 == ifaces[0].snaplen ? origlen : ifaces[0].snaplen})};
+                                frames_.push_back({
+                                        .data = body.subspan(4, caplen),
+                                        .ts   = frames_.empty() ? std::chrono::nanoseconds{}
+                                                                : frames_.back().ts,
+                                });
+                        } break;
+                        default:
+                                break;
+                }
+        }
+}
+
+std::string const& replay_engine::name() const { return ndev_; }
+
+// nothing goes out for real, so nothing is worth computing for it
+uint32_t replay_engine::offloads() const {
+        return kOffloadCsum | kOffloadTSO4 | kOffloadSG;
+}
+
+size_t replay_engine::mtu() const { return mtu_; }
+
+void replay_engine::set_mtu(size_t mtu) { mtu_ = mtu; }
+
+void replay_engine::start(device& dev) {
+        dev_ = &dev;
+        in_skbs_.reserve(dev_->rx_batch());
+
+        loop_start_ = std::chrono::steady_clock::now();
+        post_batch();
+}
+
+void replay_engine::resume_rx() { post_batch(); }
+
+void replay_engine::post_batch() {
+        io_ctx_.post([this, alive = std::weak_ptr{alive_}] {
+                if (!alive.expired()) replay_batch();
+        });
+}
+
+void replay_engine::schedule(std::chrono::steady_clock::time_point due) {
+        timer_.expires_at(due);
+        // a timer destroyed with the engine completes with operation_aborted
+        timer_.async_wait([this](boost::system::error_code const& ec) {
+                if (!ec) replay_batch();
+        });
+}
+
+void replay_engine::replay_batch() {
+        assert(dev_);
+        assert(in_skbs_.empty());
+
+        auto const now{std::chrono::steady_clock::now()};
+        // when @f is due in the current loop at the configured speed
+        auto const due{[this](frame const& f) {
+                auto const since{std::chrono::duration<double, std::nano>(
+                        (f.ts - frames_.front().ts).count() / opts_.speed)};
+                return loop_start_ +
+                       std::chrono::duration_cast<std::chrono::steady_clock::duration>(since);
+        }};
+
+        while (next_ < frames_.size() && in_skbs_.size() < dev_->rx_batch()) {
+                auto const& f{frames_[next_]};
+                if (opts_.speed > 0 && due(f) > now) break;
+
+                auto skb{skbuff{pool_, f.data.size()}};
+                std::ranges::copy(f.data, skb.head());
+                in_skbs_.push_back(std::move(skb));
+                ++next_;
+        }
+
+        if (!in_skbs_.empty()) {
+                deliver(*dev_, in_skbs_);
+                in_skbs_.clear();
+        }
+
+        if (!(next_ < frames_.size())) {
+                if (frames_.empty() || ++loop_ == opts_.loops) {
+                        spdlog::info("[REPLAY] {} DONE {} LOOPS", ndev_, loop_);
+                        if (opts_.on_done) opts_.on_done();
+                        return;
+                }
+                next_       = 0;
+                loop_start_ = now;
+        }
+
+        if (pause_rx(*dev_)) return;
+
+        // the rest of the event loop gets its turn between two batches
+        if (opts_.speed > 0)
+                schedule(due(frames_[next_]));
+        else
+                post_batch();
+}
+
+size_t replay_engine::transmit(std::queue<skbuff>& skbs) {
+        assert(dev_);
+
+        auto const nframes{skbs.size()};
+        for (; !skbs.empty(); skbs.pop())
+                stats(*dev_).tx_bytes += skbs.front().len();
+        stats(*dev_).tx_packets += nframes;
+
+        return nframes;
+}
+
+}  // namespace mstack
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "device_engine.hpp"
+#include "skb_pool.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+struct replay_options {
+        // 0 replays as fast as the stack takes the frames, 1 at the recorded
+        // rate, 2 twice as fast and so on
+        double speed{0};
+        // times the capture is played through, 0 for ever
+        size_t loops{1};
+        // called once the last loop is over
+        std::function<void()> on_done;
+};
+
+/**
+ *  Feeds the ethernet frames of a pcap or pcapng capture @path to the stack as
+ *  if they had been received, frames the stack sends are counted and dropped.
+ *  The capture is mapped into memory and indexed up front, every frame is
+ *  copied into a pool skbuff on its way in, so replaying measures the receive
+ *  path from the device up without a TAP or root.
+ */
+class replay_engine : public device_engine {
+public:
+        explicit replay_engine(boost::asio::io_context& io_ctx,
+                               skb_pool&                pool,
+                               std::string_view         path,
+                               replay_options           opts = {});
+        ~replay_engine() noexcept override;
+
+        std::string const& name() const override;
+
+        uint32_t offloads() const override;
+
+        size_t mtu() const override;
+        void   set_mtu(size_t mtu) override;
+
+        void start(device& dev) override;
+
+        size_t transmit(std::queue<skbuff>& skbs) override;
+
+        void resume_rx() override;
+
+        size_t frames() const { return frames_.size(); }
+
+private:
+        struct frame {
+                std::span<std::byte const> data;
+                std::chrono::nanoseconds   ts;
+        };
+
+        void index_pcap();
+
+        void index_pcapng();
+
+        void replay_batch();
+
+        void schedule(std::chrono::steady_clock::time_point due);
+
+        /**
+         *  Posts replay_batch(), which is skipped if the engine is gone by then
+         */
+        void post_batch();
+
+        boost::asio::io_context&  io_ctx_;
+        boost::asio::steady_timer timer_;
+        skb_pool&                 pool_;
+        std::string               ndev_;
+        replay_options            opts_;
+        device*                   dev_{nullptr};
+        size_t                    mtu_;
+
+        std::byte* map_{nullptr};
+        size_t     map_sz_{0};
+
+        std::vector<frame>                    frames_;
+        size_t                                next_{0};
+        size_t                                loop_{0};
+        std::chrono::steady_clock::time_point loop_start_;
+
+        std::vector<skbuff> in_skbs_;
+
+        // what post_batch() posted only holds a weak reference to it
+        std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
+};
+
+}  // namespace mstack
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <span>
+
+#include "size_literals.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  Bytes written by the application and not acknowledged yet, kept in
+ *  reference counted chunks. Segments refer to the chunks as skbuff fragments
+ *  instead of copying out of them: bytes are only ever appended behind what a
+ *  chunk holds already and a chunk dropped from the queue lives on until the
+ *  last segment referring to it dies, so a fragment never changes under a
+ *  frame waiting in a device queue.
+ */
+class send_queue {
+public:
+        static constexpr size_t kChunkSize{64_KiB};
+
+        explicit send_queue(size_t capacity) : capacity_(capacity) {}
+
+        size_t size() const { return size_; }
+        size_t capacity() const { return capacity_; }
+        bool   empty() const { return 0 == size_; }
+
+        void append(std::span<std::byte const> data) {
+                assert(!(size_ + data.size() > capacity_));
+
+                while (!data.empty()) {
+                        if (chunks_.empty() || !(chunks_.back().end < kChunkSize))
+                                chunks_.push_back({
+                                        .buf   = std::make_shared_for_overwrite<std::byte[]>(
+                                                kChunkSize),
+                                        .begin = 0,
+                                        .end   = 0,
+                                });
+
+                        auto&      chunk{chunks_.back()};
+                        auto const n{std::min(data.size(), kChunkSize - chunk.end)};
+                        std::ranges::copy(data.first(n), chunk.buf.get() + chunk.end);
+                        chunk.end += n;
+                        size_ += n;
+                        data = data.subspan(n);
+                }
+        }
+
+        void erase_begin(size_t n) {
+                assert(!(n > size_));
+
+                size_ -= n;
+                while (n > 0) {
+                        auto&      chunk{chunks_.front()};
+                        auto const k{std::min(n, chunk.end - chunk.begin)};
+                        chunk.begin += k;
+                        n -= k;
+                        if (chunk.begin == chunk.end) chunks_.pop_front();
+                }
+        }
+
+        /**
+         *  Appends the @len bytes at @off to @skb as fragments
+         */
+        void attach(skbuff& skb, size_t off, size_t len) const {
+                assert(!(off + len > size_));
+
+                for (auto const& chunk : chunks_) {
+                        if (0 == len) break;
+
+                        auto const held{chunk.end - chunk.begin};
+                        if (!(off < held)) {
+                                off -= held;
+                                continue;
+                        }
+
+                        auto const n{std::min(len, held - off)};
+                        skb.add_frag({chunk.buf.get() + chunk.begin + off, n}, chunk.buf);
+                        off = 0;
+                        len -= n;
+                }
+        }
+
+private:
+        struct chunk {
+                std::shared_ptr<std::byte[]> buf;
+                size_t                       begin;
+                size_t                       end;
+        };
+
+        std::deque<chunk> chunks_;
+        size_t            size_{0};
+        size_t            capacity_;
+};
+
+}  // namespace mstack
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "size_literals.hpp"
+
+namespace mstack {
+
+struct skb_pool_stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t in_use;
+        uint64_t high_water_mark;
+};
+
+/**
+ *  Where the buffer of an skbuff comes from and where it goes back to when the
+ *  skbuff dies
+ */
+class skb_allocator : public std::enable_shared_from_this<skb_allocator> {
+public:
+        virtual ~skb_allocator() = default;
+
+        virtual std::byte* acquire(size_t size) = 0;
+
+        virtual void release(std::byte* buf, size_t size) noexcept = 0;
+};
+
+/**
+ *  Per-netns cache of packet buffers split in fixed size classes. Buffers
+ *  released by skbuffs are kept on free lists and handed out again, so once
+ *  the pool has warmed up to the working set no packet touches the global
+ *  allocator. Requests above the largest class are served from the heap and
+ *  are not cached. Not thread-safe: a pool belongs to a single netns.
+ */
+class skb_pool : public skb_allocator {
+public:
+        static constexpr size_t kMTUClassSize{2_KiB};
+        static constexpr size_t kJumboClassSize{10_KiB};
+        // a 64 KiB GSO frame along with its link layer and vnet headers
+        static constexpr size_t kGSOClassSize{66_KiB};
+
+        skb_pool() = default;
+        ~skb_pool() noexcept override {
+                for (auto& free : free_)
+                        for (auto* buf : free)
+                                delete[] buf;
+        }
+
+        skb_pool(skb_pool const&)            = delete;
+        skb_pool& operator=(skb_pool const&) = delete;
+
+        skb_pool(skb_pool&&)            = delete;
+        skb_pool& operator=(skb_pool&&) = delete;
+
+        std::byte* acquire(size_t size) override {
+                std::byte* buf{nullptr};
+
+                if (auto const cls{class_of(size)}; cls < kClassSizes.size()) {
+                        if (!free_[cls].empty()) {
+                                buf = free_[cls].back();
+                                free_[cls].pop_back();
+                                ++stats_.hits;
+                        } else {
+                                buf = new std::byte[kClassSizes[cls]];
+                                ++stats_.misses;
+                        }
+                } else {
+                        buf = new std::byte[size];
+                        ++stats_.misses;
+                }
+
+                ++stats_.in_use;
+                stats_.high_water_mark = std::max(stats_.high_water_mark, stats_.in_use);
+
+                return buf;
+        }
+
+        void release(std::byte* buf, size_t size) noexcept override {
+                assert(buf);
+                assert(stats_.in_use > 0);
+
+                --stats_.in_use;
+
+                if (auto const cls{class_of(size)}; cls < kClassSizes.size())
+                        free_[cls].push_back(buf);
+                else
+                        delete[] buf;
+        }
+
+        skb_pool_stats const& stats() const { return stats_; }
+
+private:
+        static constexpr std::array<size_t, 3> kClassSizes{kMTUClassSize, kJumboClassSize,
+                                                                 kGSOClassSize};
+
+        static size_t class_of(size_t size) {
+                return std::ranges::lower_bound(kClassSizes, size) - kClassSizes.begin();
+        }
+
+        std::array<std::vector<std::byte*>, kClassSizes.size()> free_;
+        skb_pool_stats                                          stats_{};
+};
+
+}  // namespace mstack
@@ -2,18 +2,66 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 
 #include <algorithm>
 #include <memory>
 #include <span>
 #include <utility>
 
+#include <boost/container/small_vector.hpp>
+
+#include "skb_pool.hpp"
+
 namespace mstack {
 
+/**
+ *  Work left to the device for an outgoing frame, or done by the kernel already
+ *  for an incoming one. Offsets are counted from the start of the buffer, so
+ *  they stay valid while headers are pushed and popped.
+ */
+struct skb_offload {
+        // the checksum field at csum_start + csum_offset holds the pseudo header
+        // sum only, the rest is to be summed from csum_start to the tail
+        bool     csum_partial;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+        // TCP over IPv4 frame to be split into gso_size sized segments, 0 if none
+        uint16_t gso_size;
+};
+
+/**
+ *  Payload slice an skbuff refers to rather than holds, @owner keeps the memory
+ *  it lives in alive for as long as the skbuff does
+ */
+struct skb_frag {
+        std::span<std::byte const>  data;
+        std::shared_ptr<void const> owner;
+};
+
+/**
+ *  A linear buffer with room around the data for headers to be pushed and
+ *  popped in place, optionally followed by fragments: payload slices living in
+ *  memory the skbuff does not own. Fragments go out as they are with a gather
+ *  write, or get copied into the linear part by linearize() for code that
+ *  needs the frame in one piece.
+ */
 class skbuff {
 private:
-        std::unique_ptr<std::byte[]> data_;
-        size_t                       capacity_;
+        struct deleter {
+                std::shared_ptr<skb_allocator> pool;
+                size_t                         size;
+
+                void operator()(std::byte* buf) const noexcept {
+                        if (pool)
+                                pool->release(buf, size);
+                        else
+                                delete[] buf;
+                }
+        };
+
+        std::unique_ptr<std::byte[], deleter> data_;
+        size_t                                capacity_;
 
         std::byte* start_;
         std::byte* end_;
@@ -21,13 +69,15 @@ private:
         std::byte* head_;
         std::byte* tail_;
 
-public:
-        skbuff() = default;
+        skb_offload offload_{};
 
-        explicit skbuff(std::unique_ptr<std::byte[]> data,
-                        size_t                       capacity,
-                        size_t                       headroom = 0,
-                        size_t                       tailroom = 0)
+        boost::container::small_vector<skb_frag, 2> frags_;
+        size_t                                      frags_len_{0};
+
+        explicit skbuff(std::unique_ptr<std::byte[], deleter> data,
+                        size_t                                capacity,
+                        size_t                                headroom,
+                        size_t                                tailroom)
             : data_{std::move(data)},
               capacity_{capacity},
               start_{data_.get()},
@@ -38,19 +88,59 @@ public:
                 assert(!(head_ > tail_));
         }
 
+public:
+        skbuff() = default;
+
+        explicit skbuff(std::unique_ptr<std::byte[]> data,
+                        size_t                       capacity,
+                        size_t                       headroom = 0,
+                        size_t                       tailroom = 0)
+            : skbuff{
+                      std::unique_ptr<std::byte[], deleter>{data.release()},
+                      capacity,
+                      headroom,
+                      tailroom,
+              } {}
+
+        /**
+         *  Takes the buffer from @pool, it is given back when the skbuff dies
+         */
+        explicit skbuff(skb_allocator& pool,
+                        size_t         capacity,
+                        size_t         headroom = 0,
+                        size_t         tailroom = 0)
+            : skbuff{
+                      std::unique_ptr<std::byte[], deleter>{
+                              pool.acquire(capacity),
+                              deleter{pool.shared_from_this(), capacity},
+                      },
+                      capacity,
+                      headroom,
+                      tailroom,
+              } {}
+
+        /**
+         *  Adopts @buf taken from @pool beforehand for the same @capacity
+         */
+        explicit skbuff(skb_allocator& pool,
+                        std::byte*     buf,
+                        size_t         capacity,
+                        size_t         headroom = 0,
+                        size_t         tailroom = 0)
+            : skbuff{
+                      std::unique_ptr<std::byte[], deleter>{
+                              buf,
+                              deleter{pool.shared_from_this(), capacity},
+                      },
+                      capacity,
+                      headroom,
+                      tailroom,
+              } {}
+
         ~skbuff() = default;
 
         skbuff(skbuff const& other) {
-                if (this != &other) {
-                        auto data = std::make_unique_for_overwrite<std::byte[]>(other.capacity_);
-                        std::ranges::copy(other.payload(), data.get() + other.headroom());
-                        *this = skbuff{
-                                std::move(data),
-                                other.capacity_,
-                                other.headroom(),
-                                other.tailroom(),
-                        };
-                }
+                if (this != &other) *this = other.copy(other.data_.get_deleter().pool.get());
         }
 
         skbuff& operator=(skbuff const& other) {
@@ -65,6 +155,27 @@ public:
         skbuff(skbuff&&)            = default;
         skbuff& operator=(skbuff&&) = default;
 
+        /**
+         *  A deep copy in a buffer taken from @pool, or from the heap if it is
+         *  nullptr. A heap buffer may die on any thread, unlike a pooled one.
+         */
+        skbuff copy(skb_allocator* pool) const {
+                auto data{
+                        pool ? skbuff{*pool, capacity_, headroom(), tailroom()}
+                             : skbuff{
+                                       std::make_unique_for_overwrite<std::byte[]>(capacity_),
+                                       capacity_,
+                                       headroom(),
+                                       tailroom(),
+                               },
+                };
+                std::ranges::copy(payload(), data.head());
+                data.offload_   = offload_;
+                data.frags_     = frags_;
+                data.frags_len_ = frags_len_;
+                return data;
+        }
+
 public:
         // std::byte const* start() const { return start_; }
         // std::byte*       start() { return start_; }
@@ -88,6 +199,56 @@ public:
 
         size_t capacity() const { return capacity_; }
 
+        /**
+         *  The allocator the buffer goes back to, nullptr for a heap buffer
+         */
+        skb_allocator const* allocator() const { return data_.get_deleter().pool.get(); }
+
+        skb_offload const& offload() const { return offload_; }
+        skb_offload&       offload() { return offload_; }
+
+        std::span<skb_frag const> frags() const { return {frags_.data(), frags_.size()}; }
+
+        /**
+         *  Appends @data to the frame without a copy, @owner is kept until the
+         *  skbuff dies
+         */
+        void add_frag(std::span<std::byte const> data, std::shared_ptr<void const> owner) {
+                assert(owner);
+                frags_len_ += data.size();
+                frags_.push_back({data, std::move(owner)});
+        }
+
+        bool is_linear() const { return frags_.empty(); }
+
+        /**
+         *  Length of the whole frame, fragments included
+         */
+        size_t len() const { return payload().size() + frags_len_; }
+
+        /**
+         *  Copies the whole frame to @dst, returns how many bytes that was
+         */
+        size_t copy_to(std::byte* dst) const {
+                auto* out{std::ranges::copy(payload(), dst).out};
+                for (auto const& frag : frags_)
+                        out = std::ranges::copy(frag.data, out).out;
+                return out - dst;
+        }
+
+        /**
+         *  Pulls the fragments into a linear buffer taken from @pool, the
+         *  headroom and so the offload offsets stay the same
+         */
+        void linearize(skb_allocator& pool) {
+                if (is_linear()) return;
+
+                auto linear{skbuff{pool, headroom() + len(), headroom(), len()}};
+                linear.push_back(copy_to(linear.head()));
+                linear.offload_ = offload_;
+                *this           = std::move(linear);
+        }
+
         size_t headroom() const { return head() - start_; }
         size_t tailroom() const { return end_ - tail(); }
 
@@ -8,9 +8,31 @@
 
 #include "netns.hpp"
 #include "socket.hpp"
+#include "tcb.hpp"
+#include "tcb_manager.hpp"
 
 namespace mstack {
 
+namespace {
+
+// @cb run back on the shard of the calling thread, if it runs one
+std::function<void(boost::system::error_code const&, size_t)> complete_here(
+        tcb_manager& tcb_m, std::function<void(boost::system::error_code const&, size_t)> cb) {
+        auto const here{tcb_manager::this_thread_shard()};
+        if (tcb_manager::kNoShard == here) return cb;
+
+        return [&tcb_m, here, cb = std::move(cb)](boost::system::error_code const& ec,
+                                                  size_t                           nbytes) {
+                if (tcb_manager::this_thread_shard() == here) {
+                        cb(ec, nbytes);
+                } else {
+                        tcb_m.submit(here, [cb, ec, nbytes] { cb(ec, nbytes); });
+                }
+        };
+}
+
+}  // namespace
+
 socket::socket(netns& net) : net_(net) {}
 
 socket::socket() : socket(netns::_default_()) {}
@@ -59,11 +81,18 @@ void socket::async_connect(endpoint const&
 
 void socket::async_read_some(std::span<std::byte>                                          buf,
                              std::function<void(boost::system::error_code const&, size_t)> cb) {
-        if (auto sp = this->tcb.lock()) {
+        auto sp{this->tcb.lock()};
+        if (!sp) throw std::runtime_error("endpoint is not connected");
+
+        // the connection follows the thread reading it
+        sp->steer_here();
+        if (sp->on_home_thread()) {
                 sp->async_read_some(buf, std::move(cb));
-        } else {
-                throw std::runtime_error("endpoint is not connected");
+                return;
         }
+        sp->dispatch([sp, buf, cb = complete_here(net_.tcb_m(), std::move(cb))]() mutable {
+                sp->async_read_some(buf, std::move(cb));
+        });
 }
 
 void socket::async_read(std::span<std::byte>                                          buf,
@@ -98,11 +127,24 @@ void socket::async_write_some(std::span<std::byte const>
 
 void socket::async_write(std::span<std::byte const>                                    buf,
                          std::function<void(boost::system::error_code const&, size_t)> cb) {
-        if (auto sp{this->tcb.lock()}) {
+        auto sp{this->tcb.lock()};
+        if (!sp) throw std::runtime_error("endpoint is not connected");
+
+        sp->steer_here();
+        if (sp->on_home_thread()) {
                 sp->async_write(buf, std::move(cb));
-        } else {
-                throw std::runtime_error("endpoint is not connected");
+                return;
         }
+        sp->dispatch([sp, buf, cb = complete_here(net_.tcb_m(), std::move(cb))]() mutable {
+                sp->async_write(buf, std::move(cb));
+        });
+}
+
+void socket::set_congestion_control(cc_algorithm algo) {
+        auto sp{this->tcb.lock()};
+        if (!sp) throw std::runtime_error("endpoint is not connected");
+
+        sp->dispatch([sp, algo] { sp->set_congestion_control(algo); });
 }
 
 endpoint socket::remote_endpoint() const {
@@ -8,6 +8,7 @@
 
 #include <boost/system/error_code.hpp>
 
+#include "congestion_control.hpp"
 #include "defination.hpp"
 #include "endpoint.hpp"
 
@@ -49,6 +50,11 @@ public:
         void async_write(std::span<std::byte const>                                    buf,
                          std::function<void(boost::system::error_code const&, size_t)> cb);
 
+        /**
+         *  Congestion control of the connection, connected sockets only
+         */
+        void set_congestion_control(cc_algorithm algo);
+
         endpoint const& local_endpoint() const { return local_ep; }
 
         endpoint remote_endpoint() const;
@@ -0,0 +1,255 @@
+#include "tap_engine.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <tuple>
+
+#include <linux/if_tun.h>
+#include <sys/uio.h>
+
+#include <boost/container/small_vector.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include "device.hpp"
+#include "file_desc.hpp"
+#include "netns.hpp"
+#include "offload.hpp"
+#include "skb_pool.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+namespace {
+
+// struct virtio_net_hdr, <linux/virtio_net.h> does not compile as C++
+struct vnet_hdr {
+        uint8_t  flags;
+        uint8_t  gso_type;
+        uint16_t hdr_len;
+        uint16_t gso_size;
+        uint16_t csum_start;
+        uint16_t csum_offset;
+};
+
+constexpr uint8_t kVnetHdrNeedsCsum{1};
+constexpr uint8_t kVnetHdrGsoTCPv4{1};
+constexpr uint8_t kVnetHdrGsoECN{0x80};
+
+}  // namespace
+
+file_desc tap_open(std::string_view name,
+                   int              fd_flags,
+                   std::string&     ndev,
+                   int tun_flags /* = 0*/) {
+        auto fd{file_desc::open("/dev/net/tun", file_desc::RDWR | fd_flags)};
+        if (!fd) throw std::runtime_error{std::format("[TAP] OPEN FAIL")};
+
+        spdlog::debug("[TAP] DEV FD {}", fd->get_fd());
+
+        ifreq ifr{};
+
+        ifr.ifr_flags = static_cast<short>(IFF_TAP | IFF_NO_PI | tun_flags);
+
+        name = name.substr(0, std::min(name.size(), sizeof(ifr.ifr_name) - 1));
+        std::ranges::copy(name, std::begin(ifr.ifr_name));
+
+        if (int ec{fd->ioctl(TUNSETIFF, ifr)}; ec < 0)
+                throw std::runtime_error{std::format("[TAP] SETUP FAIL")};
+
+        ndev.assign(ifr.ifr_name);
+
+        return std::move(*fd);
+}
+
+tap_engine::tap_engine(boost::asio::io_context& io_ctx,
+                       std::string_view         name /* = ""*/,
+                       bool                     multi_queue /* = false*/)
+    : pfd_(io_ctx) {
+        auto fd{tap_open(name, file_desc::NONBLOCK, ndev_,
+                         IFF_VNET_HDR | (multi_queue ? IFF_MULTI_QUEUE : 0))};
+
+        // what the kernel may pass to us, frames we write are accepted with any
+        // offload described in their vnet header regardless
+        if (::ioctl(fd.get_fd(), TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4) < 0)
+                spdlog::warn("[DEV {}] RX OFFLOADS OFF {}", ndev_, strerror(errno));
+        else
+                rx_gso_ = true;
+
+        pfd_.assign(fd.get_fd());
+        std::ignore = fd.release();
+}
+
+std::string const& tap_engine::name() const { return ndev_; }
+
+uint32_t tap_engine::offloads() const { return kOffloadCsum | kOffloadTSO4 | kOffloadSG; }
+
+void tap_engine::start(device& dev) {
+        dev_ = &dev;
+        in_skbs_.reserve(dev_->rx_batch());
+        async_receive();
+}
+
+size_t tap_engine::rx_frame_size() const {
+        assert(dev_);
+        return sizeof(vnet_hdr) + dev_->rx_frame_size();
+}
+
+void tap_engine::receive_batch() {
+        assert(dev_);
+        assert(in_skbs_.empty());
+
+        auto&      pool{dev_->net().pool()};
+        auto const frame_size{rx_frame_size()};
+
+        while (in_skbs_.size() < dev_->rx_batch()) {
+                auto skb{skbuff{pool, frame_size, 0, frame_size}};
+
+                // GSO frames can be as large as an IPv4 datagram whatever the MTU
+                // is, what does not fit the MTU sized buffer spills over into one
+                // that large, at the offset the frame continues at
+                std::array<iovec, 2> iov{{{skb.tail(), frame_size}, {}}};
+                if (rx_gso_) {
+                        if (!rx_spill_)
+                                rx_spill_.emplace(pool, skb_pool::kGSOClassSize, 0,
+                                                  skb_pool::kGSOClassSize);
+                        iov[1] = {rx_spill_->tail() + frame_size,
+                                  skb_pool::kGSOClassSize - frame_size};
+                }
+                auto const nbytes{
+                        ::readv(pfd_.native_handle(), iov.data(), rx_gso_ ? 2 : 1)};
+                if (nbytes < 0) {
+                        if (EINTR == errno) continue;
+                        if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                                ++stats(*dev_).rx_errors;
+                                spdlog::warn("[DEV {}] RECEIVE FAIL {}", ndev_, strerror(errno));
+                        }
+                        break;
+                }
+                if (static_cast<size_t>(nbytes) < sizeof(vnet_hdr)) {
+                        ++stats(*dev_).rx_errors;
+                        continue;
+                }
+                if (static_cast<size_t>(nbytes) > frame_size) {
+                        // the head goes in front of the rest, a new spill buffer is
+                        // taken for the next GSO frame
+                        std::memcpy(rx_spill_->tail(), skb.tail(), frame_size);
+                        skb = std::move(*rx_spill_);
+                        rx_spill_.reset();
+                }
+                skb.push_back(nbytes);
+
+                vnet_hdr hdr;
+                std::memcpy(&hdr, skb.head(), sizeof(hdr));
+                skb.pop_front(sizeof(hdr));
+
+                auto& offload{skb.offload()};
+                if (hdr.flags & kVnetHdrNeedsCsum) {
+                        offload.csum_partial = true;
+                        offload.csum_start =
+                                static_cast<uint16_t>(skb.headroom() + hdr.csum_start);
+                        offload.csum_offset = hdr.csum_offset;
+                }
+                if (kVnetHdrGsoTCPv4 == (hdr.gso_type & ~kVnetHdrGsoECN))
+                        offload.gso_size = hdr.gso_size;
+
+                in_skbs_.push_back(std::move(skb));
+        }
+
+        if (in_skbs_.empty()) return;
+
+        deliver(*dev_, in_skbs_);
+        in_skbs_.clear();
+}
+
+void tap_engine::async_receive() {
+        pfd_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                        [this](boost::system::error_code const& ec) {
+                                if (ec) {
+                                        spdlog::warn("[DEV {}] RECEIVE FAIL {}", ndev_, ec.what());
+                                        async_receive();
+                                        return;
+                                }
+                                receive_batch();
+                                if (pause_rx(*dev_)) return;
+                                async_receive();
+                        });
+}
+
+void tap_engine::resume_rx() { async_receive(); }
+
+size_t tap_engine::transmit(std::queue<skbuff>& skbs) {
+        assert(dev_);
+
+        if (tx_blocked_) return 0;
+
+        size_t nframes{0};
+
+        while (!skbs.empty()) {
+                auto const& skb{skbs.front()};
+                auto const  buf{skb.payload()};
+
+                vnet_hdr hdr{};
+                if (auto const& offload{skb.offload()}; offload.csum_partial) {
+                        hdr.flags = kVnetHdrNeedsCsum;
+                        hdr.csum_start =
+                                static_cast<uint16_t>(offload.csum_start - skb.headroom());
+                        hdr.csum_offset = offload.csum_offset;
+                        if (offload.gso_size > 0) {
+                                // data offset of the TCP header the checksum starts at
+                                auto const doff{buf[hdr.csum_start + 12] >> 4};
+                                hdr.gso_type = kVnetHdrGsoTCPv4;
+                                hdr.gso_size = offload.gso_size;
+                                hdr.hdr_len  = static_cast<uint16_t>(
+                                        hdr.csum_start + (std::to_integer<uint16_t>(doff) << 2));
+                        }
+                }
+
+                // the vnet header, the linear part and the fragments in one write
+                boost::container::small_vector<iovec, 4> iov{
+                        {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+                        {.iov_base = const_cast<std::byte*>(buf.data()), .iov_len = buf.size()},
+                };
+                for (auto const& frag : skb.frags())
+                        iov.push_back({
+                                .iov_base = const_cast<std::byte*>(frag.data.data()),
+                                .iov_len  = frag.data.size(),
+                        });
+
+                auto const nbytes{
+                        ::writev(pfd_.native_handle(), iov.data(), static_cast<int>(iov.size()))};
+                if (nbytes < 0) {
+                        if (EINTR == errno) continue;
+                        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                                tx_blocked_ = true;
+                                pfd_.async_wait(boost::asio::posix::stream_descriptor::wait_write,
+                                                [this](boost::system::error_code const& ec) {
+                                                        if (ec)
+                                                                spdlog::warn(
+                                                                        "[DEV {}] WRITE FAIL {}",
+                                                                        ndev_, ec.what());
+                                                        tx_blocked_ = false;
+                                                        resume_tx(*dev_);
+                                                });
+                                break;
+                        }
+                        ++stats(*dev_).tx_errors;
+                        spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_, strerror(errno));
+                } else {
+                        ++nframes;
+                        stats(*dev_).tx_bytes += nbytes - sizeof(hdr);
+                }
+                skbs.pop();
+        }
+
+        stats(*dev_).tx_packets += nframes;
+
+        return nframes;
+}
+
+}  // namespace mstack
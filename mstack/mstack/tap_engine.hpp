@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "device_engine.hpp"
+#include "file_desc.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  Opens /dev/net/tun with @fd_flags and attaches it to the TAP interface
+ *  @name with IFF_* @tun_flags on top of IFF_TAP | IFF_NO_PI, the kernel picks
+ *  a name if @name is empty. The name the interface ended up with is stored to
+ *  @ndev.
+ */
+file_desc tap_open(std::string_view name, int fd_flags, std::string& ndev, int tun_flags = 0);
+
+/**
+ *  Readiness based engine: the TAP fd is watched by the io_context reactor,
+ *  frames are read and written with plain non-blocking syscalls. Every frame is
+ *  preceded by a virtio_net_hdr (IFF_VNET_HDR), which lets TCP segments go out
+ *  with partial checksums and as 64 KiB GSO frames and lets the kernel hand
+ *  over the same in the other direction.
+ */
+class tap_engine : public device_engine {
+public:
+        /**
+         *  With @multi_queue set the fd becomes one of the queues of @name
+         *  (IFF_MULTI_QUEUE), the kernel spreads flows across all of them
+         */
+        explicit tap_engine(boost::asio::io_context& io_ctx,
+                            std::string_view         name        = "",
+                            bool                     multi_queue = false);
+        ~tap_engine() override = default;
+
+        std::string const& name() const override;
+
+        uint32_t offloads() const override;
+
+        void start(device& dev) override;
+
+        size_t transmit(std::queue<skbuff>& skbs) override;
+
+        void resume_rx() override;
+
+private:
+        void async_receive();
+
+        void receive_batch();
+
+        size_t rx_frame_size() const;
+
+        boost::asio::posix::stream_descriptor pfd_;
+        std::string                           ndev_;
+        device*                               dev_{nullptr};
+        bool                                  rx_gso_{false};
+        std::vector<skbuff>                   in_skbs_;
+        // GSO sized, for what of a frame does not fit rx_frame_size()
+        std::optional<skbuff>                 rx_spill_;
+        bool                                  tx_blocked_{false};
+};
+
+}  // namespace mstack
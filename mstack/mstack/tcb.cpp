@@ -5,27 +5,37 @@
 #include <cstdint>
 
 #include <algorithm>
+#include <chrono>
 #include <concepts>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <queue>
 #include <random>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include <spdlog/spdlog.h>
 
+#include <boost/asio/error.hpp>
 #include <boost/circular_buffer.hpp>
 
+#include "bbr.hpp"
+#include "congestion_control.hpp"
+#include "cubic.hpp"
 #include "defination.hpp"
 #include "ethernet_header.hpp"
 #include "ipv4_header.hpp"
+#include "newreno.hpp"
 #include "skbuff.hpp"
 #include "socket.hpp"
 #include "tcb.hpp"
 #include "tcb_manager.hpp"
 #include "tcp_header.hpp"
 #include "tcp_packet.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 namespace {
@@ -38,6 +48,36 @@ enum : uint8_t {
         kTSO  = 8,
 };
 
+// the largest segment an IPv4 datagram can carry, anything above the MSS goes
+// down as one GSO frame and is split up by the device or the TAP
+constexpr size_t kGSOSegmentMax{0xffff - mstack::ipv4_header_t::fixed_size() -
+                                mstack::tcp_header_t::fixed_size()};
+
+// RFC 6298 bounds, except for the floor: 200 ms like Linux instead of the 1 s
+// the RFC asks for, which would stall recovery on a LAN for seconds
+constexpr std::chrono::milliseconds kRtoInitial{1000};
+constexpr std::chrono::milliseconds kRtoMin{200};
+constexpr std::chrono::milliseconds kRtoMax{60000};
+// RFC 6298 5.7
+constexpr std::chrono::milliseconds kRtoAfterSynLoss{3000};
+
+// the connection is given up on after that many timeouts in a row, as with
+// Linux's default tcp_retries2
+constexpr uint16_t kRetransmitsMax{15};
+
+std::unique_ptr<mstack::congestion_control> make_congestion_control(mstack::cc_algorithm algo) {
+        switch (algo) {
+                case mstack::cc_algorithm::newreno:
+                        return std::make_unique<mstack::newreno>();
+                case mstack::cc_algorithm::cubic:
+                        return std::make_unique<mstack::cubic>();
+                case mstack::cc_algorithm::bbr:
+                        return std::make_unique<mstack::bbr>();
+        }
+        assert(false);
+        return {};
+}
+
 struct nop {};
 
 struct mss {
@@ -167,42 +207,113 @@ tcb_t::tcb_t(boost::asio::io_context&                  io_ctx,
                                 endpoint const&                  remote_ep,
                                 endpoint const&                  local_ep,
                                 std::weak_ptr<tcb_t>)> on_connection_established)
-    : io_ctx_(io_ctx),
-      mngr_(mngr),
+    : io_ctx_(&io_ctx),
+      mngr_(&mngr),
+      origin_(mngr),
+      shard_(mngr.shard_self()),
+      steer_(tcb_manager::kNoShard),
       remote_ep_(remote_ep),
       local_ep_(local_ep),
       state_(state),
       next_state_(next_state),
-      on_connection_established_(std::move(on_connection_established)) {
+      on_connection_established_(std::move(on_connection_established)),
+      rto_timer_([this] { on_rto(); }),
+      pace_timer_([this] { send_app_data(); }) {
         assert(on_connection_established_);
 
+        send_.state     = {};
+        send_.state.rto = kRtoInitial;
+        send_.cc        = make_congestion_control(mngr.default_congestion_control());
+
         rcv_.state.window = 0xFAF0u;
         rcv_.pq           = std::make_unique<boost::circular_buffer<std::byte>>(rcv_.state.window);
 }
 
+template <typename Fn>
+void tcb_t::post(Fn&& fn) {
+        io_ctx_->post([this, fn = std::forward<Fn>(fn)]() mutable {
+                if (on_home_thread()) {
+                        fn();
+                } else {
+                        dispatch(std::move(fn));
+                }
+        });
+}
+
+bool tcb_t::on_home_thread() const {
+        return !origin_.sharded() ||
+               shard_.load(std::memory_order_acquire) == tcb_manager::this_thread_shard();
+}
+
+void tcb_t::dispatch(task fn) {
+        if (on_home_thread()) {
+                fn();
+                return;
+        }
+        // checked again on arrival, the connection may be moving on
+        origin_.submit(shard_.load(std::memory_order_acquire),
+                       [self{shared_from_this()}, fn = std::move(fn)]() mutable {
+                               self->dispatch(std::move(fn));
+                       });
+}
+
+void tcb_t::steer_here() {
+        auto const here{tcb_manager::this_thread_shard()};
+        // the owner reads it with every segment, so only a change is written
+        if (tcb_manager::kNoShard != here && steer_.load(std::memory_order_relaxed) != here)
+                steer_.store(here, std::memory_order_relaxed);
+}
+
+void tcb_t::set_congestion_control(cc_algorithm algo) {
+        send_.cc = make_congestion_control(algo);
+}
+
+bool tcb_t::migratable() const { return kTCPEstablished == state_; }
+
+void tcb_t::move_to(tcb_manager& mngr, size_t to) {
+        // the wheel belongs to this shard's thread, the new one arms it again
+        mngr_->timers().cancel(rto_timer_);
+        mngr_->timers().cancel(pace_timer_);
+
+        io_ctx_ = &mngr.io_context();
+        mngr_   = &mngr;
+        shard_.store(to, std::memory_order_release);
+}
+
+void tcb_t::adopted() {
+        if (has_unacknowledged()) mngr_->timers().arm(rto_timer_, send_.state.rto);
+        // the shard it came from no longer resumes it, nor fires the pacing
+        // timer
+        tx_waiting_ = false;
+        send_app_data();
+}
+
 void tcb_t::async_read_some(std::span<std::byte>                                          buf,
                             std::function<void(boost::system::error_code const&, size_t)> cb) {
-        if (!rcv_.pq->empty()) {
+        if (error_) {
+                post([ec = error_, cb = std::move(cb)] { cb(ec, 0); });
+        } else if (!rcv_.pq->empty()) {
                 buf = buf.subspan(0, std::min(rcv_.pq->size(), buf.size()));
                 std::copy_n(rcv_.pq->begin(), buf.size(), buf.begin());
                 rcv_.pq->erase_begin(buf.size());
                 rcv_.state.next += buf.size();
-                io_ctx_.post([this, len = buf.size(), cb = std::move(cb)] {
+                post([this, len = buf.size(), cb = std::move(cb)] {
                         cb({}, len);
                         make_and_send_pkt();
                 });
         } else {
-                on_data_receive_.push({
-                        buf,
-                        [cb = std::move(cb)](size_t nbytes) { cb({}, nbytes); },
-                });
+                on_data_receive_.push({buf, std::move(cb)});
         }
 }
 
 void tcb_t::async_write(std::span<std::byte const>                                    buf,
                         std::function<void(boost::system::error_code const&, size_t)> cb) {
+        if (error_) {
+                post([ec = error_, cb = std::move(cb)] { cb(ec, 0); });
+                return;
+        }
         enqueue_app_data(buf);
-        io_ctx_.post([sz = buf.size(), cb = std::move(cb)] { cb({}, sz); });
+        post([sz = buf.size(), cb = std::move(cb)] { cb({}, sz); });
 }
 
 void tcb_t::make_and_send_pkt() { enqueue(make_packet()); }
@@ -213,8 +324,30 @@ size_t tcb_t::app_data_unacknowleged() const {
 }
 
 size_t tcb_t::app_data_to_send_left() const {
-        return std::min(static_cast<size_t>(send_.state.mss),
-                        send_.pq->size() - app_data_unacknowleged());
+        if (0 == send_.state.mss) return 0;
+
+        auto const pending{send_.pq->size() - app_data_unacknowleged()};
+        // RFC 5681 2, no more in flight than both cwnd and the peer's window allow
+        auto const wnd{std::min<size_t>(send_.state.cwnd, send_.state.window)};
+        auto const flight{static_cast<size_t>(send_.state.seq_nr_next - send_.state.seq_nr_unack)};
+        auto const room{wnd > flight ? wnd - flight : 0};
+
+        auto len{std::min({kGSOSegmentMax, pending, room})};
+
+        if (auto const rate{send_.cc->pacing_rate()}; 0 != rate) {
+                if (timer_wheel::clock::now() < next_send_) return 0;
+                // what the rate allows for a tick of the wheel goes out at once
+                len = std::min(len, std::max<size_t>(2 * send_.state.mss, rate / 1000));
+        }
+
+        // RFC 1122 4.2.3.4, no small segment while what is in flight may
+        // open the window for a full one
+        if (len < send_.state.mss && len < pending && flight > 0) return 0;
+        return len;
+}
+
+bool tcb_t::has_unacknowledged() const {
+        return send_.state.seq_nr_max != send_.state.seq_nr_unack;
 }
 
 bool tcb_t::has_app_data_to_send() const { return 0 != app_data_to_send_left(); }
@@ -222,48 +355,93 @@ bool tcb_t::has_app_data_to_send() const { return 0 != app_data_to_send_left();
 void tcb_t::enqueue_app_data(std::span<std::byte const> pkt) {
         assert(!(send_.pq->size() + pkt.size() > send_.pq->capacity()));
 
-        send_.pq->insert(send_.pq->end(), pkt.begin(), pkt.end());
-        io_ctx_.post([this] {
-                while (has_app_data_to_send())
-                        make_and_send_pkt();
-        });
+        send_.pq->append(pkt);
+        post([this] { send_app_data(); });
+}
+
+void tcb_t::send_app_data() {
+        // the route is looked up once for the whole batch
+        std::shared_ptr<device> dev;
+        for (bool first{true}; has_app_data_to_send(); first = false) {
+                if (first) dev = mngr_->tx_device(remote_ep_.addrv4);
+                // segments would only be dropped further down, the rest waits in
+                // the send queue
+                if (mngr_->tx_backlogged(dev.get())) {
+                        if (!std::exchange(tx_waiting_, true)) mngr_->wait_tx(weak_from_this());
+                        return;
+                }
+                make_and_send_pkt();
+        }
+
+        if (0 == send_.pq->size() - app_data_unacknowleged()) {
+                // nothing to send, delivery is held back by us and not the path
+                rate_.on_app_limited(send_.state.seq_nr_max - send_.state.seq_nr_unack);
+                return;
+        }
+        auto const now{timer_wheel::clock::now()};
+        if (now < next_send_ && !pace_timer_.armed())
+                mngr_->timers().arm(pace_timer_, next_send_ - now);
+}
+
+void tcb_t::resume_tx() {
+        tx_waiting_ = false;
+        send_app_data();
 }
 
 void tcb_t::listen_finish() {
-        io_ctx_.post([this] {
+        post([this] {
                 on_connection_established_({}, remote_ep_, local_ep_, weak_from_this());
         });
 }
 
 tcp_packet tcb_t::make_packet() {
         auto const seg_len{app_data_to_send_left()};
+        auto const syn{kTCPSynReceived == next_state_};
+
+        auto pkt{make_segment(0 == seg_len ? send_.state.seq_nr_unack : send_.state.seq_nr_next,
+                              app_data_unacknowleged(), seg_len)};
+        if (seg_len > 0) on_data_sent(seg_len);
+        send_.state.seq_nr_next += seg_len;
+
+        // only what goes out for the first time is timed, see rto_sent()
+        auto const fresh{static_cast<int32_t>(send_.state.seq_nr_next - send_.state.seq_nr_max) >
+                         0};
+        if (fresh) send_.state.seq_nr_max = send_.state.seq_nr_next;
+        if (fresh || syn) rto_sent();
+
+        if (next_state_ != state_) state_ = next_state_;
+
+        return pkt;
+}
+
+tcp_packet tcb_t::make_segment(uint32_t seq, size_t off, size_t len, bool rst /* = false*/) {
+        auto const syn{kTCPSynReceived == next_state_};
+        // the SYN-ACK carries our MSS, the peer would fall back to 536 otherwise
+        auto const opts_len{syn ? size_t{4} : size_t{0}};
         auto const headroom{ethernetv2_header_t::size() + ipv4_header_t::fixed_size()};
-        auto const room{headroom + tcp_header_t::fixed_size() + seg_len};
+        auto const room{headroom + tcp_header_t::fixed_size() + opts_len};
 
-        auto skb_out = skbuff{
-                std::make_unique_for_overwrite<std::byte[]>(room),
-                room,
-                headroom,
-        };
+        // headers only, the payload is referred to in the send queue
+        auto skb_out = skbuff{mngr_->pool(), room, headroom};
 
         assert(0 == (tcp_header_t::fixed_size() & 0x3));
 
         auto const out_tcp = tcp_header_t{
                 .src_port = local_ep_.addrv4_port,
                 .dst_port = remote_ep_.addrv4_port,
-                .seq_no   = 0 == seg_len ? send_.state.seq_nr_unack : send_.state.seq_nr_next,
+                .seq_no   = seq,
                 .ack_no   = rcv_.state.next,
 
-                .data_offset = tcp_header_t::fixed_size() >> 2,
+                .data_offset = static_cast<uint16_t>((tcp_header_t::fixed_size() + opts_len) >> 2),
                 .reserved    = 0,
 
                 .CWR = 0,
                 .ECE = 0,
                 .URG = 0,
                 .ACK = 1,
-                .PSH = seg_len > 0,
-                .RST = 0,
-                .SYN = kTCPSynReceived == next_state_,
+                .PSH = len > 0,
+                .RST = rst,
+                .SYN = syn,
                 .FIN = 0,
 
                 .window         = rcv_.state.window,
@@ -271,13 +449,12 @@ tcp_packet tcb_t::make_packet() {
                 .urgent_pointer = 0,
         };
 
-        assert(!((send_.pq->begin() + app_data_unacknowleged() + seg_len) > send_.pq->end()));
+        auto* const opts{out_tcp.produce_to_net(skb_out.head())};
+        if (syn) encode_options({opts, opts_len}, tcp_options{{mss{.value = rcv_.state.mss}}});
 
-        std::copy_n(send_.pq->begin() + app_data_unacknowleged(), seg_len,
-                    out_tcp.produce_to_net(skb_out.head()));
-        send_.state.seq_nr_next += seg_len;
+        send_.pq->attach(skb_out, off, len);
 
-        if (next_state_ != state_) state_ = next_state_;
+        if (len > send_.state.mss) skb_out.offload().gso_size = send_.state.mss;
 
         return {
                 .proto     = tcb_manager::PROTO,
@@ -287,6 +464,194 @@ tcp_packet tcb_t::make_packet() {
         };
 }
 
+void tcb_t::rto_sent() {
+        if (!rtt_timing_) {
+                rtt_timing_ = true;
+                rtt_seq_    = send_.state.seq_nr_next;
+                rtt_start_  = timer_wheel::clock::now();
+        }
+        if (!rto_timer_.armed()) mngr_->timers().arm(rto_timer_, send_.state.rto);
+}
+
+void tcb_t::on_data_sent(size_t len) {
+        auto const now{timer_wheel::clock::now()};
+        rate_.on_sent(send_.state.seq_nr_next + len, !has_unacknowledged(), now);
+
+        auto const rate{send_.cc->pacing_rate()};
+        if (0 == rate) return;
+        // the segment takes len / rate on the wire, the next one waits for it
+        auto const wire{std::chrono::nanoseconds{len * 1'000'000'000 / rate}};
+        next_send_ = std::max(now, next_send_) + wire;
+}
+
+void tcb_t::rto_acked() {
+        // RFC 6298 5.3, and Karn: only a segment sent once is timed
+        if (rtt_timing_ && !(static_cast<int32_t>(send_.state.seq_nr_unack - rtt_seq_) < 0)) {
+                auto const rtt{timer_wheel::clock::now() - rtt_start_};
+                rtt_timing_ = false;
+                rtt_update(std::chrono::duration_cast<std::chrono::milliseconds>(rtt));
+                send_.cc->on_rtt_sample(send_, rtt);
+        }
+
+        send_.state.backoff     = 0;
+        send_.state.retransmits = 0;
+
+        // RFC 6298 5.2
+        if (has_unacknowledged()) {
+                mngr_->timers().arm(rto_timer_, send_.state.rto);
+        } else {
+                mngr_->timers().cancel(rto_timer_);
+        }
+}
+
+void tcb_t::rtt_update(std::chrono::milliseconds r) {
+        auto& s{send_.state};
+
+        // RFC 6298 2.2 and 2.3, no sample yet while both are zero
+        if (0 == s.srtt.count() && 0 == s.rttvar.count()) {
+                s.srtt   = r;
+                s.rttvar = r / 2;
+        } else {
+                s.rttvar = (3 * s.rttvar + std::chrono::abs(s.srtt - r)) / 4;
+                s.srtt   = (7 * s.srtt + r) / 8;
+        }
+
+        auto const rto{s.srtt + std::max<std::chrono::milliseconds>(timer_wheel::kTick,
+                                                                     4 * s.rttvar)};
+        s.rto = std::clamp(rto, kRtoMin, kRtoMax);
+}
+
+void tcb_t::on_rto() {
+        if (!has_unacknowledged()) return;
+
+        if (++send_.state.retransmits > kRetransmitsMax) {
+                spdlog::warn("[TCP RTO] {} GIVES UP AFTER {} RETRANSMITS", *this, kRetransmitsMax);
+                abort(boost::asio::error::timed_out);
+                return;
+        }
+
+        // RFC 6298 5.5 and 5.6, and Karn: a retransmitted segment is not timed
+        send_.state.rto = std::min(send_.state.rto * 2, kRtoMax);
+        ++send_.state.backoff;
+        rtt_timing_ = false;
+
+        switch (state_) {
+                case kTCPSynSent:
+                        send_syn();
+                        break;
+                case kTCPSynReceived:
+                        enqueue(make_segment(send_.state.seq_nr_unack, 0, 0));
+                        break;
+                default:
+                        send_.cc->on_rto(send_);
+                        send_.state.in_recovery = false;
+                        send_.state.dupacks     = 0;
+                        send_.state.recover     = send_.state.seq_nr_max;
+                        // RFC 6298 5.4 starting with the earliest segment not
+                        // acknowledged, the rest follows as the window opens
+                        send_.state.seq_nr_next = send_.state.seq_nr_unack;
+                        // what was in flight is sent anew, and not held back
+                        rate_.reset();
+                        next_send_ = {};
+                        make_and_send_pkt();
+                        break;
+        }
+
+        mngr_->timers().arm(rto_timer_, send_.state.rto);
+}
+
+void tcb_t::abort(boost::system::error_code const& ec) {
+        auto const connecting{kTCPSynSent == state_};
+
+        state_      = kTCPClosed;
+        next_state_ = kTCPClosed;
+        error_      = ec;
+
+        mngr_->timers().cancel(rto_timer_);
+        mngr_->timers().cancel(pace_timer_);
+
+        // RFC 9293 3.10.7.1, <SEQ=SND.NXT><CTL=RST>, a SYN never answered
+        // left nothing at the peer to reset
+        if (!connecting) enqueue(make_segment(send_.state.seq_nr_max, 0, 0, true));
+
+        post([this, self{shared_from_this()}, ec, connecting,
+              reads{std::exchange(on_data_receive_, {})}]() mutable {
+                if (connecting) on_connection_established_(ec, remote_ep_, local_ep_, {});
+                for (; !reads.empty(); reads.pop())
+                        reads.front().second(ec, 0);
+
+                // the last reference may go with it, self keeps the tcb alive
+                // until this returns
+                mngr_->remove(*this);
+        });
+}
+
+void tcb_t::cc_start() {
+        auto& s{send_.state};
+        // RFC 5681 3.1, one segment if the SYN or the SYN-ACK had to be sent again
+        s.cwnd     = s.backoff > 0 ? s.mss : congestion_control::initial_window(s.mss);
+        s.ssthresh = std::numeric_limits<uint32_t>::max();
+        // RFC 6582 3.2 (1), the ISS: a loss of the first data segment is
+        // fast retransmitted as well
+        s.recover = s.seq_nr_unack - 1;
+}
+
+void tcb_t::on_new_ack(uint32_t acked) {
+        auto& s{send_.state};
+
+        rto_acked();
+        s.dupacks = 0;
+
+        if (!s.in_recovery) {
+                send_.cc->on_ack(send_, acked);
+        } else if (static_cast<int32_t>(s.seq_nr_unack - s.recover) < 0) {
+                // RFC 6582 3.2 (5), a partial ACK: the next hole is sent again and
+                // the window deflated by what has left the network
+                retransmit_head();
+                s.cwnd -= std::min(s.cwnd, acked);
+                if (!(acked < s.mss)) s.cwnd += s.mss;
+        } else {
+                // RFC 6582 3.2 (6), a full ACK ends recovery
+                auto const flight{s.seq_nr_max - s.seq_nr_unack};
+                s.cwnd = std::min<uint32_t>(s.ssthresh, std::max<uint32_t>(flight, s.mss) + s.mss);
+                s.in_recovery = false;
+        }
+
+        if (auto const rs{rate_.on_ack(s.seq_nr_unack, acked, timer_wheel::clock::now())})
+                send_.cc->on_rate_sample(send_, *rs);
+
+        send_app_data();
+}
+
+void tcb_t::on_dupack() {
+        auto& s{send_.state};
+
+        ++s.dupacks;
+        if (s.in_recovery) {
+                // RFC 6582 3.2 (4), each one means a segment has left the network
+                s.cwnd += s.mss;
+                send_app_data();
+        } else if (3 == s.dupacks && static_cast<int32_t>(s.seq_nr_unack - s.recover) > 0) {
+                // RFC 6582 3.2 (2) and (3)
+                send_.cc->on_loss(send_);
+                s.recover     = s.seq_nr_max;
+                s.in_recovery = true;
+                retransmit_head();
+                s.cwnd = s.ssthresh + 3 * s.mss;
+                send_app_data();
+        }
+}
+
+void tcb_t::retransmit_head() {
+        // Karn, an ACK would not tell which one it was for
+        rtt_timing_ = false;
+
+        auto const len{std::min<size_t>({send_.pq->size(),
+                                         send_.state.seq_nr_max - send_.state.seq_nr_unack,
+                                         send_.state.mss})};
+        enqueue(make_segment(send_.state.seq_nr_unack, 0, len));
+}
+
 uint32_t tcb_t::generate_isn() { return std::random_device{}(); }
 
 bool tcb_t::tcp_handle_close_state(tcp_header_t const& tcph) {
@@ -383,13 +748,17 @@ bool tcb_t::tcp_handle_listen_state(tcp_header_t const& tcph, std::span<std::byt
          */
 
         if (tcph.SYN) {
+                rcv_.state.mss = mngr_->mss_to(remote_ep_.addrv4);
+
                 for (auto const& opt : decode_options(opts)) {
                         std::visit(
                                 [this](auto const& opt) {
                                         using type = std::decay_t<decltype(opt)>;
                                         if constexpr (std::same_as<type, nop>) {
                                         } else if constexpr (std::same_as<type, mss>) {
-                                                send_.state.mss = opt.value;
+                                                // segments have to fit our own MTU too
+                                                send_.state.mss =
+                                                        std::min(opt.value, rcv_.state.mss);
                                         } else if constexpr (std::same_as<type, window_scale>) {
                                         } else if constexpr (std::same_as<type, sack>) {
                                         } else if constexpr (std::same_as<type, timestamp>) {
@@ -402,8 +771,9 @@ bool tcb_t::tcp_handle_listen_state(tcp_header_t const& tcph, std::span<std::byt
 
                 rcv_.state.next    = tcph.seq_no + 1;
                 send_.state.window = tcph.window;
-                send_.pq = std::make_unique<boost::circular_buffer<std::byte>>(send_.state.window);
+                send_.pq = std::make_unique<send_queue>(send_.state.window);
                 send_.state.seq_nr_next  = isn + 1;
+                send_.state.seq_nr_max   = isn + 1;
                 send_.state.seq_nr_unack = isn;
                 next_state_              = kTCPSynReceived;
                 make_and_send_pkt();
@@ -434,8 +804,7 @@ bool tcb_t::tcp_handle_syn_sent(tcp_header_t const& tcph, std::span<std::byte co
                     !(tcph.ack_no > send_.state.seq_nr_next)) {
                         rcv_.state.next    = tcph.seq_no + 1;
                         send_.state.window = tcph.window;
-                        send_.pq           = std::make_unique<boost::circular_buffer<std::byte>>(
-                                send_.state.window);
+                        send_.pq           = std::make_unique<send_queue>(send_.state.window);
                         send_.state.seq_nr_unack = tcph.ack_no;
 
                         for (auto const& opt : decode_options(opts)) {
@@ -444,7 +813,8 @@ bool tcb_t::tcp_handle_syn_sent(tcp_header_t const& tcph, std::span<std::byte co
                                                 using type = std::decay_t<decltype(opt)>;
                                                 if constexpr (std::same_as<type, nop>) {
                                                 } else if constexpr (std::same_as<type, mss>) {
-                                                        send_.state.mss = opt.value;
+                                                        send_.state.mss = std::min(
+                                                                opt.value, rcv_.state.mss);
                                                 } else if constexpr (std::same_as<type,
                                                                                   window_scale>) {
                                                 } else if constexpr (std::same_as<type, sack>) {
@@ -458,6 +828,12 @@ bool tcb_t::tcp_handle_syn_sent(tcp_header_t const& tcph, std::span<std::byte co
                         state_      = kTCPEstablished;
                         next_state_ = kTCPEstablished;
 
+                        // RFC 6298 5.7
+                        if (send_.state.backoff > 0)
+                                send_.state.rto = std::max(send_.state.rto, kRtoAfterSynLoss);
+                        cc_start();
+                        rto_acked();
+
                         make_and_send_pkt();
 
                         listen_finish();
@@ -660,16 +1036,13 @@ void tcb_t::process(tcp_packet&& pkt_in) {
 
         auto const segment{std::as_bytes(pkt_in.skb.payload())};
 
-        spdlog::debug("[TCP] RECEIVE h={}, hlen={}, optlen={}, seglen={}", tcph, hlen, optlen,
-                      segment.size());
+        MSTACK_TRACE_EVENT(tcb_rx, state_, tcph.src_port << 16 | tcph.dst_port, tcph.seq_no,
+                           uint64_t{tcph.ack_no} << 32 | segment.size());
 
-        spdlog::debug("[TCP] [CHECK TCP_CLOSED] {}", *this);
         if (state_ == kTCPClosed && tcp_handle_close_state(tcph)) return;
 
-        spdlog::debug("[TCP] [CHECK TCP_LISTEN] {}", *this);
         if (state_ == kTCPListen && tcp_handle_listen_state(tcph, opts)) return;
 
-        spdlog::debug("[TCP] [CHECK TCP_SYN_SENT] {}", *this);
         if (state_ == kTCPSynSent && tcp_handle_syn_sent(tcph, opts)) return;
 
         // first check sequence number
@@ -817,6 +1190,12 @@ void tcb_t::process(tcp_packet&& pkt_in) {
                                                            send_.state.seq_nr_next);
                                         state_      = kTCPEstablished;
                                         next_state_ = kTCPEstablished;
+                                        // RFC 6298 5.7
+                                        if (send_.state.backoff > 0)
+                                                send_.state.rto = std::max(send_.state.rto,
+                                                                           kRtoAfterSynLoss);
+                                        cc_start();
+                                        rto_acked();
                                         listen_finish();
                                 } else {
                                         // TODO: send RST
@@ -850,21 +1229,37 @@ void tcb_t::process(tcp_packet&& pkt_in) {
                         case kTCPFinWait_1:
                         case kTCPFinWait_2:
                         case kTCPCloseWait:
-                        case kTCPClosing:
-                                send_.pq->erase_begin(
-                                        std::min(send_.pq->size(),
-                                                 static_cast<size_t>(tcph.ack_no -
-                                                                     send_.state.seq_nr_unack)));
-
-                                send_.state.seq_nr_unack =
-                                        std::clamp(tcph.ack_no, send_.state.seq_nr_unack,
-                                                   send_.state.seq_nr_next);
+                        case kTCPClosing: {
+                                auto const acked{tcph.ack_no - send_.state.seq_nr_unack};
+                                auto const sent{send_.state.seq_nr_max - send_.state.seq_nr_unack};
 
-                                if (tcph.ack_no > send_.state.seq_nr_next) {
+                                if (static_cast<int32_t>(acked) > 0 && acked > sent) {
                                         make_and_send_pkt();
                                         return;
                                 }
 
+                                if (static_cast<int32_t>(acked) > 0) {
+                                        send_.pq->erase_begin(
+                                                std::min(send_.pq->size(), size_t{acked}));
+                                        send_.state.seq_nr_unack = tcph.ack_no;
+                                        // what a timeout made us send again may have been
+                                        // acknowledged all along
+                                        if (static_cast<int32_t>(send_.state.seq_nr_next -
+                                                                 send_.state.seq_nr_unack) < 0)
+                                                send_.state.seq_nr_next = send_.state.seq_nr_unack;
+                                        send_.state.window = tcph.window;
+                                        on_new_ack(acked);
+                                } else if (0 == acked) {
+                                        // RFC 5681 2, duplicate only if it carries nothing else
+                                        auto const dup{segment.empty() && !tcph.FIN &&
+                                                       tcph.window == send_.state.window &&
+                                                       has_unacknowledged()};
+                                        auto const opened{tcph.window > send_.state.window};
+                                        send_.state.window = tcph.window;
+                                        if (dup) on_dupack();
+                                        if (opened) send_app_data();
+                                }
+
                                 /**
                                  *  FIN-WAIT-1 STATE
                                  *      In addition to the processing for the ESTABLISHED
@@ -902,6 +1297,7 @@ void tcb_t::process(tcp_packet&& pkt_in) {
                                         next_state_ = kTCPTimeWait;
                                 }
                                 break;
+                        }
                         /**
                          *  LAST-ACK STATE
                          *      The only thing that can arrive in this state is an
@@ -995,7 +1391,6 @@ void tcb_t::process(tcp_packet&& pkt_in) {
                         case kTCPEstablished:
                         case kTCPFinWait_1:
                         case kTCPFinWait_2: {
-                                spdlog::debug("[TCP] RECEIVE DATA {}", segment.size());
 
                                 if (!(tcph.seq_no < rcv_.state.next + rcv_.pq->size())) {
                                         if (!on_data_receive_.empty()) {
@@ -1017,9 +1412,9 @@ void tcb_t::process(tcp_packet&& pkt_in) {
                                                 std::ranges::copy(segment.subspan(buf.size()),
                                                                   rcv_.pq->begin());
 
-                                                io_ctx_.post([this, len = buf.size(),
+                                                post([this, len = buf.size(),
                                                               cb = std::move(cb)] {
-                                                        cb(len);
+                                                        cb({}, len);
                                                         make_and_send_pkt();
                                                 });
                                         } else {
@@ -1126,13 +1521,29 @@ void tcb_t::process(tcp_packet&& pkt_in) {
 }
 
 void tcb_t::enqueue(tcp_packet&& out_pkt) {
-        spdlog::debug("[TCP] ENQUEUE {}", out_pkt);
-        mngr_.enqueue(std::move(out_pkt));
+#ifdef MSTACK_TRACE
+        auto const tcph{tcp_header_t::consume_from_net(out_pkt.skb.head())};
+        MSTACK_TRACE_EVENT(tcb_tx, state_, tcph.src_port << 16 | tcph.dst_port, tcph.seq_no,
+                           uint64_t{tcph.ack_no} << 32 | out_pkt.skb.len());
+#endif
+        mngr_->enqueue(std::move(out_pkt));
 }
 
 void tcb_t::start_connecting() {
-        rcv_.state.mss = 1446;  // due to MTU being 1500 by default
+        rcv_.state.mss = mngr_->mss_to(remote_ep_.addrv4);
+
+        send_.state.seq_nr_unack = generate_isn();
+        send_.state.seq_nr_next  = send_.state.seq_nr_unack + 1;
+        send_.state.seq_nr_max   = send_.state.seq_nr_next;
+
+        state_      = kTCPSynSent;
+        next_state_ = kTCPEstablished;
+
+        send_syn();
+        rto_sent();
+}
 
+void tcb_t::send_syn() {
         auto const opts{
                 tcp_options{
                         {
@@ -1147,18 +1558,14 @@ void tcb_t::start_connecting() {
         auto const headroom{ethernetv2_header_t::size() + ipv4_header_t::fixed_size()};
         auto const room{headroom + tcp_header_t::fixed_size() + 8};
 
-        auto skb_out = skbuff{
-                std::make_unique_for_overwrite<std::byte[]>(room),
-                room,
-                headroom,
-        };
+        auto skb_out = skbuff{mngr_->pool(), room, headroom};
 
         assert(0 == (tcp_header_t::fixed_size() & 0x3));
 
         auto const out_tcp = tcp_header_t{
                 .src_port    = local_ep_.addrv4_port,
                 .dst_port    = remote_ep_.addrv4_port,
-                .seq_no      = generate_isn(),
+                .seq_no      = send_.state.seq_nr_unack,
                 .ack_no      = 0,
                 .data_offset = static_cast<uint16_t>(skb_out.payload().size() >> 2),
                 .reserved    = 0,
@@ -1177,14 +1584,8 @@ void tcb_t::start_connecting() {
                 .urgent_pointer = 0,
         };
 
-        send_.state.seq_nr_unack = out_tcp.seq_no;
-        send_.state.seq_nr_next  = out_tcp.seq_no + 1;
-
         encode_options({out_tcp.produce_to_net(skb_out.head()), 8}, opts);
 
-        state_      = kTCPSynSent;
-        next_state_ = kTCPEstablished;
-
         enqueue({
                 .proto     = 0x06,
                 .remote_ep = remote_ep_,
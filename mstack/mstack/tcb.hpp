@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <iterator>
@@ -17,11 +18,16 @@
 
 #include <fmt/format.h>
 
+#include "channel.hpp"
+#include "congestion_control.hpp"
+#include "delivery_rate.hpp"
 #include "mstack/endpoint.hpp"
+#include "send_queue.hpp"
 #include "skbuff.hpp"
 #include "socket.hpp"
 #include "tcp_header.hpp"
 #include "tcp_packet.hpp"
+#include "timer_wheel.hpp"
 
 namespace mstack {
 
@@ -31,12 +37,18 @@ struct send {
         struct {
                 uint32_t seq_nr_unack;
                 uint32_t seq_nr_next;
+                // the highest seq_nr_next has been, a timeout winds the latter
+                // back to seq_nr_unack to send everything again
+                uint32_t seq_nr_max;
                 uint16_t window;
                 uint8_t  window_scale;
                 uint16_t mss;
                 uint32_t cwnd;
                 uint32_t ssthresh;
                 uint16_t dupacks;
+                // RFC 6582, fast recovery lasts until seq_nr_unack gets there
+                uint32_t recover;
+                bool     in_recovery;
                 uint16_t retransmits;
                 uint16_t backoff;
 
@@ -44,7 +56,8 @@ struct send {
                 std::chrono::milliseconds srtt;
                 std::chrono::milliseconds rto;
         } state;
-        std::unique_ptr<boost::circular_buffer<std::byte>> pq;
+        std::unique_ptr<send_queue>         pq;
+        std::unique_ptr<congestion_control> cc;
 };
 
 struct receive {
@@ -61,8 +74,17 @@ class tcb_manager;
 
 class tcb_t : public std::enable_shared_from_this<tcb_t> {
 private:
-        boost::asio::io_context& io_ctx_;
-        tcb_manager&             mngr_;
+        // of the shard the connection belongs to, they change when it moves
+        boost::asio::io_context* io_ctx_;
+        tcb_manager*             mngr_;
+        // set the connection up and keeps it in its table for good, it hands
+        // work over to other shards from any thread
+        tcb_manager& origin_;
+
+        // the shard the connection belongs to, and the one whose thread last
+        // used its socket
+        std::atomic<size_t> shard_;
+        std::atomic<size_t> steer_;
 
         endpoint remote_ep_;
         endpoint local_ep_;
@@ -75,11 +97,35 @@ private:
                            std::weak_ptr<tcb_t>)>
                 on_connection_established_;
 
-        std::queue<std::pair<std::span<std::byte>, std::function<void(size_t)>>> on_data_receive_;
+        std::queue<std::pair<std::span<std::byte>,
+                             std::function<void(boost::system::error_code const&, size_t)>>>
+                on_data_receive_;
+
+        // why the connection was given up on, what is asked of it afterwards
+        // completes with it
+        boost::system::error_code error_;
 
         send    send_;
         receive rcv_;
 
+        // waiting for tcb_manager to call resume_tx()
+        bool tx_waiting_{false};
+
+        // RFC 6298 retransmission timer, on the wheel of the current shard
+        timer_wheel::timer rto_timer_;
+        // one segment at a time is timed for an RTT sample, until the ACK
+        // reaches rtt_seq_
+        bool                           rtt_timing_{false};
+        uint32_t                       rtt_seq_{0};
+        timer_wheel::clock::time_point rtt_start_;
+
+        // samples the rate data is delivered at for the congestion control
+        delivery_rate rate_;
+        // while the congestion control paces, data leaves no earlier than
+        // next_send_ and pace_timer_ sends what waits until then
+        timer_wheel::timer             pace_timer_;
+        timer_wheel::clock::time_point next_send_{};
+
         explicit tcb_t(boost::asio::io_context&                  io_ctx,
                        tcb_manager&                              mngr,
                        endpoint const&                           remote_info,
@@ -114,13 +160,72 @@ public:
 
         void start_connecting();
 
+        /**
+         *  Gives the connection up: the peer gets a reset, every operation
+         *  pending completes with @ec and the tcb_manager forgets it. Called on
+         *  the thread of the shard it belongs to.
+         */
+        void abort(boost::system::error_code const& ec);
+
+        /**
+         *  Switches the connection over to @algo, the window is kept
+         */
+        void set_congestion_control(cc_algorithm algo);
+
+        /**
+         *  true if the calling thread is the one of the shard the connection
+         *  belongs to, always for a netns of its own
+         */
+        bool on_home_thread() const;
+
+        /**
+         *  Runs @fn on the thread of the shard the connection belongs to, right
+         *  away if that is the calling one
+         */
+        void dispatch(task fn);
+
+        /**
+         *  Asks for the connection to move to the shard of the calling thread,
+         *  which its tcb_manager does with the next segment, see tcb_manager
+         */
+        void steer_here();
+
+        size_t shard() const { return shard_.load(std::memory_order_acquire); }
+        size_t steered_to() const { return steer_.load(std::memory_order_relaxed); }
+
+        bool migratable() const;
+
+        /**
+         *  Called on the thread of the current shard, which from then on leaves
+         *  the connection to @mngr of shard @to
+         */
+        void move_to(tcb_manager& mngr, size_t to);
+
+        /**
+         *  Called on the thread of the shard the connection has moved to
+         */
+        void adopted();
+
+        /**
+         *  Sends what waited in the send queue for a backlog to clear
+         */
+        void resume_tx();
+
         void process(tcp_packet&& in_packet);
 
         endpoint const& local_endpoint() const { return local_ep_; }
         endpoint const& remote_endpoint() const { return remote_ep_; }
 
 private:
+        /**
+         *  Posts @fn to the shard the connection belongs to, it goes on to the
+         *  next one if the connection has moved meanwhile
+         */
+        template <typename Fn>
+        void post(Fn&& fn);
+
         size_t app_data_unacknowleged() const;
+        bool   has_unacknowledged() const;
         size_t app_data_to_send_left() const;
 
         bool has_app_data_to_send() const;
@@ -133,10 +238,59 @@ private:
 
         void enqueue_app_data(std::span<std::byte const> packet);
 
+        void send_app_data();
+
         skbuff prepare_data_optional(int& option_len);
 
         tcp_packet make_packet();
 
+        /**
+         *  A segment at @seq carrying the @len bytes at @off in the send queue,
+         *  or a reset if @rst is set, the state is left alone
+         */
+        tcp_packet make_segment(uint32_t seq, size_t off, size_t len, bool rst = false);
+
+        void send_syn();
+
+        /**
+         *  Called once a segment taking sequence space is sent: starts the
+         *  retransmission timer unless it runs, and an RTT sample unless one is
+         *  taken
+         */
+        void rto_sent();
+
+        /**
+         *  Called before @len bytes of data from SND.NXT go out: samples the
+         *  delivery rate and pushes the time the next segment may leave at
+         */
+        void on_data_sent(size_t len);
+
+        /**
+         *  Called once SND.UNA moved ahead
+         */
+        void rto_acked();
+
+        void rtt_update(std::chrono::milliseconds r);
+
+        void on_rto();
+
+        /**
+         *  cwnd and ssthresh a connection starts with once established
+         */
+        void cc_start();
+
+        /**
+         *  An ACK moved SND.UNA ahead by @acked bytes
+         */
+        void on_new_ack(uint32_t acked);
+
+        void on_dupack();
+
+        /**
+         *  Sends the earliest segment not acknowledged again
+         */
+        void retransmit_head();
+
         bool tcp_handle_close_state(tcp_header_t const& tcph);
 
         bool tcp_handle_listen_state(tcp_header_t const& tcph, std::span<std::byte const> opts);
@@ -2,21 +2,30 @@
 
 #include <cassert>
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
 #include <random>
+#include <stdexcept>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include <boost/asio/error.hpp>
 #include <boost/asio/io_context.hpp>
 
 #include <spdlog/spdlog.h>
 
 #include "base_protocol.hpp"
 #include "defination.hpp"
+#include "device.hpp"
 #include "endpoint.hpp"
 #include "ipv4_addr.hpp"
+#include "ipv4_header.hpp"
 #include "packets.hpp"
 #include "socket.hpp"
 #include "tcb.hpp"
+#include "tcp_header.hpp"
 
 namespace mstack {
 
@@ -38,11 +47,135 @@ private:
         std::uniform_int_distribution<uint16_t> dist;
 };
 
-tcb_manager::tcb_manager(boost::asio::io_context& io_ctx)
-    : base_protocol(io_ctx), port_gen_ctx_(std::make_unique<port_generator_ctx>()) {}
+tcb_manager::tcb_manager(boost::asio::io_context&             io_ctx,
+                         std::shared_ptr<skb_pool>            pool,
+                         std::shared_ptr<routing_table const> rt,
+                         timer_wheel&                         timers)
+    : base_protocol(io_ctx),
+      port_gen_ctx_(std::make_unique<port_generator_ctx>()),
+      pool_(std::move(pool)),
+      rt_(std::move(rt)),
+      timers_(timers) {
+        assert(pool_);
+        assert(rt_);
+}
 
 tcb_manager::~tcb_manager() noexcept = default;
 
+uint16_t tcb_manager::mss_to(ipv4_addr_t const& addr) const {
+        auto nh{rt_->query(addr)};
+        if (!nh) nh = rt_->query_default();
+
+        auto const mtu{nh && nh->dev ? nh->dev->mtu() : device::kMtuDefault};
+        return static_cast<uint16_t>(mtu - ipv4_header_t::fixed_size() -
+                                     tcp_header_t::fixed_size());
+}
+
+std::shared_ptr<device> tcb_manager::tx_device(ipv4_addr_t const& addr) const {
+        auto nh{rt_->query(addr)};
+        if (!nh) nh = rt_->query_default();
+
+        return nh ? nh->dev : nullptr;
+}
+
+bool tcb_manager::tx_backlogged(device const* dev) const {
+        return tx_full() || (dev && dev->tx_backlogged());
+}
+
+void tcb_manager::wait_tx(std::weak_ptr<tcb_t> tcb) {
+        tx_waiters_.push_back(std::move(tcb));
+
+        // the queue down to tcp drains with the next flush, a device lets
+        // go on its own once it has drained
+        if (tx_full() && !tx_resume_posted_) {
+                tx_resume_posted_ = true;
+                io_ctx_.post([this] {
+                        tx_resume_posted_ = false;
+                        resume_tx();
+                });
+        }
+}
+
+void tcb_manager::resume_tx() {
+        // one that has moved to another shard meanwhile is resumed by adopt()
+        for (auto& waiter : std::exchange(tx_waiters_, {}))
+                if (auto tcb{waiter.lock()}; tcb && tcb->shard() == shards_.self) tcb->resume_tx();
+}
+
+bool tcb_manager::forward_backlogged() const {
+        return shards_.forward_backlogged && shards_.forward_backlogged();
+}
+
+void tcb_manager::wait_rx(std::weak_ptr<device> dev) {
+        auto const same{[&dev](std::weak_ptr<device> const& waiter) {
+                return !waiter.owner_before(dev) && !dev.owner_before(waiter);
+        }};
+        if (std::ranges::none_of(rx_waiters_, same)) rx_waiters_.push_back(std::move(dev));
+}
+
+void tcb_manager::resume_rx() {
+        for (auto& waiter : std::exchange(rx_waiters_, {}))
+                if (auto dev{waiter.lock()}) dev->resume_rx();
+}
+
+void tcb_manager::set_shards(shard_map shards) {
+        assert(shards.count > 0);
+        assert(shards.self < shards.count);
+        assert(1 == shards.count || shards.forward);
+        shards_ = std::move(shards);
+}
+
+size_t tcb_manager::shard_of(two_ends_t const& two_end) const {
+        return 1 == shards_.count ? 0 : flow_shard(two_end, shards_.count);
+}
+
+void tcb_manager::submit(size_t to, task fn) {
+        assert(sharded());
+        shards_.submit(to, std::move(fn));
+}
+
+void tcb_manager::adopt(std::shared_ptr<tcb_t> tcb) {
+        two_ends_t const two_end = {
+                .remote_ep = tcb->remote_endpoint(),
+                .local_ep  = tcb->local_endpoint(),
+        };
+
+        auto* p_tcb{tcb.get()};
+        if (shard_of(two_end) != shards_.self) tcbs_.insert_or_assign(two_end, std::move(tcb));
+        p_tcb->adopted();
+}
+
+void tcb_manager::hand_over(two_ends_t const& two_end, std::shared_ptr<tcb_t> tcb, size_t to) {
+        spdlog::debug("[TCB MNGR] MOVE {} <-> {} TO SHARD {}", two_end.local_ep, two_end.remote_ep,
+                      to);
+
+        if (shard_of(two_end) != shards_.self) tcbs_.erase(two_end);
+        tcb->move_to(shards_.peer(to), to);
+        shards_.hand_over(to, std::move(tcb));
+}
+
+void tcb_manager::remove(tcb_t const& tcb) {
+        two_ends_t const two_end = {
+                .remote_ep = tcb.remote_endpoint(),
+                .local_ep  = tcb.local_endpoint(),
+        };
+
+        spdlog::debug("[TCB MNGR] REMOVE {} <-> {}", two_end.local_ep, two_end.remote_ep);
+
+        // the entry of the shard that set it up keeps the tcb alive until then
+        if (auto const origin{shard_of(two_end)}; origin != shards_.self)
+                submit(origin, [peer{&shards_.peer(origin)}, two_end, p_tcb{&tcb}] {
+                        peer->erase(two_end, p_tcb);
+                });
+        erase(two_end, &tcb);
+}
+
+void tcb_manager::erase(two_ends_t const& two_end, tcb_t const* tcb) {
+        // a connection set up anew on the same two ends meanwhile stays
+        if (auto tcb_it{tcbs_.find(two_end)}; tcbs_.end() != tcb_it && tcb_it->second.get() == tcb)
+                tcbs_.erase(tcb_it);
+}
+
 void tcb_manager::rule_insert_front(
         std::function<bool(endpoint const& remote_ep, endpoint const& local_ep)> matcher,
         std::function<void(boost::system::error_code const& ec,
@@ -61,6 +194,77 @@ void tcb_manager::rule_insert_back(
         rules_.emplace_back(std::move(matcher), std::move(cb));
 }
 
+uint64_t tcb_manager::listen_reuseport(endpoint const&   local_ep,
+                                       reuseport_balance balance,
+                                       listener          l) {
+        assert(l.cb);
+        assert(l.idle);
+
+        auto group_it{std::ranges::find_if(reuseport_groups_, [&local_ep](auto const& g) {
+                return g->local_ep == local_ep;
+        })};
+
+        if (reuseport_groups_.end() == group_it) {
+                reuseport_groups_.push_back(std::make_unique<reuseport_group>(local_ep, balance));
+                group_it = std::prev(reuseport_groups_.end());
+
+                auto* g{group_it->get()};
+                rule_insert_back(
+                        [g](endpoint const& remote_ep [[maybe_unused]], endpoint const& local_ep) {
+                                return !g->members.empty() && g->local_ep.covers(local_ep);
+                        },
+                        [g](boost::system::error_code const& ec, endpoint const& remote_ep,
+                            endpoint const& local_ep, std::weak_ptr<tcb_t> tcb) {
+                                // picked once established, by then the listener it
+                                // was meant for may be gone
+                                if (g->members.empty()) {
+                                        if (auto sp{tcb.lock()})
+                                                sp->abort(boost::asio::error::connection_refused);
+                                        return;
+                                }
+
+                                auto const h{static_cast<uint32_t>(
+                                        hash_value(two_ends_t{remote_ep, local_ep}) *
+                                        0x9e3779b97f4a7c15)};
+                                auto pick{static_cast<size_t>(uint64_t{h} * g->members.size() >>
+                                                              32)};
+
+                                if (reuseport_balance::least_loaded == g->balance) {
+                                        auto most_idle{g->members[pick].second.idle()};
+                                        for (size_t i{0}; i < g->members.size(); ++i) {
+                                                if (auto const idle{g->members[i].second.idle()};
+                                                    idle > most_idle) {
+                                                        most_idle = idle;
+                                                        pick      = i;
+                                                }
+                                        }
+                                }
+
+                                // one with no accept waiting passes the flow on to
+                                // the next that has, its own backlog takes it if
+                                // none has
+                                auto const n{g->members.size()};
+                                for (size_t i{0}; i < n; ++i) {
+                                        if (0 != g->members[(pick + i) % n].second.idle()) {
+                                                pick = (pick + i) % n;
+                                                break;
+                                        }
+                                }
+
+                                g->members[pick].second.cb(ec, remote_ep, local_ep,
+                                                           std::move(tcb));
+                        });
+        }
+
+        (*group_it)->members.emplace_back(++listener_ids_, std::move(l));
+        return listener_ids_;
+}
+
+void tcb_manager::unlisten(uint64_t id) {
+        for (auto& g : reuseport_groups_)
+                std::erase_if(g->members, [id](auto const& m) { return m.first == id; });
+}
+
 void tcb_manager::async_connect(endpoint const&                           remote_ep,
                                 ipv4_addr_t const&                        local_addr,
                                 std::function<void(boost::system::error_code const& ec,
@@ -72,6 +276,7 @@ void tcb_manager::async_connect(endpoint const&                           remote
                         .remote_ep = remote_ep,
                         .local_ep  = {local_addr, port_gen_ctx_->generate()},
                 };
+                if (shard_of(two_end) != shards_.self) continue;
 
                 auto [tcb_it, created] = tcbs_.emplace(
                         two_end,
@@ -100,6 +305,10 @@ void tcb_manager::async_connect(endpoint const&                           remote
                 .local_ep  = local_ep,
         };
 
+        if (auto const owner{shard_of(two_end)}; owner != shards_.self)
+                throw std::runtime_error{fmt::format("{} <-> {} belongs to shard {}", remote_ep,
+                                                     local_ep, owner)};
+
         auto [tcb_it, created] = tcbs_.emplace(
                 two_end, tcb_t::create_shared(io_ctx_, *this, two_end.remote_ep, two_end.local_ep,
                                               kTCPConnecting, kTCPConnecting, std::move(cb)));
@@ -113,18 +322,48 @@ void tcb_manager::async_connect(endpoint const&                           remote
         tcb_it->second->start_connecting();
 }
 
-void tcb_manager::process(tcp_packet&& pkt_in) {
+void tcb_manager::process(tcp_packet&& pkt_in) { receive_from(std::move(pkt_in), shards_.self); }
+
+void tcb_manager::process_forwarded(tcp_packet&& pkt_in, size_t from) {
+        receive_from(std::move(pkt_in), from);
+}
+
+void tcb_manager::receive_from(tcp_packet&& pkt_in, size_t from) {
         two_ends_t const two_end = {
                 .remote_ep = pkt_in.remote_ep,
                 .local_ep  = pkt_in.local_ep,
         };
 
-        spdlog::debug("[TCB MNGR] RECEIVE {} -> {}", two_end.remote_ep, two_end.local_ep);
+        auto forward{[&](size_t to) {
+                // a buffer from the pool of this shard has to go back to it on
+                // this thread
+                if (from == shards_.self) pkt_in.skb = std::as_const(pkt_in.skb).copy(nullptr);
+                shards_.forward(to, std::move(pkt_in));
+        }};
 
         tcb_t* p_tcb{nullptr};
 
         if (auto tcb_it{tcbs_.find(two_end)}; tcbs_.end() != tcb_it) {
                 p_tcb = tcb_it->second.get();
+
+                if (auto const home{p_tcb->shard()}; home != shards_.self) {
+                        // the origin of a connection that has moved on. One sent
+                        // back by where it went arrived ahead of the connection,
+                        // the peer retransmits it.
+                        if (home != from) forward(home);
+                        return;
+                }
+
+                if (auto const to{p_tcb->steered_to()};
+                    to != shards_.self && to < shards_.count && p_tcb->migratable()) {
+                        hand_over(two_end, tcb_it->second, to);
+                        forward(to);
+                        return;
+                }
+        } else if (auto const origin{shard_of(two_end)}; origin != shards_.self) {
+                // came in on a queue of another shard
+                forward(origin);
+                return;
         } else {
                 for (auto const& [matcher, cb] : rules_) {
                         if (matcher(two_end.remote_ep, two_end.local_ep)) {
@@ -147,7 +386,6 @@ void tcb_manager::process(tcp_packet&& pkt_in) {
         }
 
         if (p_tcb) {
-                spdlog::debug("[TCB MNGR] HANDLE {} -> {}", two_end.remote_ep, two_end.local_ep);
                 p_tcb->process(std::move(pkt_in));
         } else {
                 spdlog::warn("[TCB MNGR] UNKNOWN INPUT {} -> {}", two_end.remote_ep,
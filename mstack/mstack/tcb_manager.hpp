@@ -4,8 +4,10 @@
 
 #include <deque>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/system/error_code.hpp>
@@ -13,13 +15,64 @@
 #include <spdlog/spdlog.h>
 
 #include "base_protocol.hpp"
+#include "channel.hpp"
+#include "congestion_control.hpp"
+#include "ipv4_addr.hpp"
 #include "packets.hpp"
+#include "routing_table.hpp"
+#include "skb_pool.hpp"
 #include "socket.hpp"
 #include "tcb.hpp"
+#include "timer_wheel.hpp"
 
 namespace mstack {
 
-class tcb_manager : public base_protocol<tcp_packet, void> {
+/**
+ *  How listeners sharing a local endpoint split its new connections
+ */
+enum class reuseport_balance : uint8_t {
+        // by a hash of the two ends, a flow always lands on the same listener
+        flow_hash,
+        // to the listener the flow hashes to, unless another has more accepts
+        // waiting
+        least_loaded,
+};
+
+class tcb_manager final : public base_protocol<tcp_packet, void> {
+public:
+        /**
+         *  Where this tcb_manager stands among the shards of a netns_group
+         */
+        struct shard_map {
+                size_t self;
+                size_t count;
+                // hands a segment over to the tcb_manager of shard @to
+                std::function<void(size_t to, tcp_packet&& pkt_in)> forward;
+                // hands a connection over, ahead of the segments that follow it
+                std::function<void(size_t to, std::shared_ptr<tcb_t> tcb)> hand_over;
+                // runs @fn on the thread of shard @to, from any thread
+                std::function<void(size_t to, task fn)> submit;
+                std::function<tcb_manager&(size_t i)>   peer;
+                // true while segments forwarded from here wait for another
+                // shard to catch up
+                std::function<bool()> forward_backlogged;
+        };
+
+        static constexpr size_t kNoShard{std::numeric_limits<size_t>::max()};
+
+        /**
+         *  One of the listeners sharing a local endpoint
+         */
+        struct listener {
+                std::function<void(boost::system::error_code const& ec,
+                                   endpoint const&                  remote_ep,
+                                   endpoint const&                  local_ep,
+                                   std::weak_ptr<tcb_t>             tcb)>
+                        cb;
+                // accepts waiting for a connection
+                std::function<size_t()> idle;
+        };
+
 private:
         class port_generator_ctx;
         std::unique_ptr<port_generator_ctx> port_gen_ctx_;
@@ -34,14 +87,48 @@ private:
         };
         std::deque<rule> rules_;
 
+        struct reuseport_group {
+                endpoint                                   local_ep;
+                reuseport_balance                          balance;
+                std::vector<std::pair<uint64_t, listener>> members;
+        };
+        // never shrinks, its rules refer to the groups
+        std::vector<std::unique_ptr<reuseport_group>> reuseport_groups_;
+        uint64_t                                      listener_ids_{0};
+
         std::unordered_map<two_ends_t, std::shared_ptr<tcb_t>> tcbs_;
 
+        std::shared_ptr<skb_pool>            pool_;
+        std::shared_ptr<routing_table const> rt_;
+        timer_wheel&                         timers_;
+
+        cc_algorithm cc_default_{cc_algorithm::newreno};
+
+        std::vector<std::weak_ptr<tcb_t>> tx_waiters_;
+        bool                              tx_resume_posted_{false};
+
+        std::vector<std::weak_ptr<device>> rx_waiters_;
+
+        shard_map shards_{.self = 0, .count = 1, .forward = {}, .hand_over = {}, .submit = {},
+                          .peer = {}, .forward_backlogged = {}};
+
+        static inline thread_local size_t this_thread_shard_{kNoShard};
+
+        void receive_from(tcp_packet&& pkt_in, size_t from);
+
+        void hand_over(two_ends_t const& two_end, std::shared_ptr<tcb_t> tcb, size_t to);
+
+        void erase(two_ends_t const& two_end, tcb_t const* tcb);
+
 public:
         constexpr static int PROTO{0x06};
 
         using base_protocol::enqueue;
 
-        explicit tcb_manager(boost::asio::io_context& io_ctx);
+        explicit tcb_manager(boost::asio::io_context&             io_ctx,
+                             std::shared_ptr<skb_pool>            pool,
+                             std::shared_ptr<routing_table const> rt,
+                             timer_wheel&                         timers);
         ~tcb_manager() noexcept;
 
         tcb_manager(tcb_manager const&)            = delete;
@@ -77,7 +164,116 @@ public:
                                    endpoint const&                  local_ep,
                                    std::weak_ptr<tcb_t>)>                                cb);
 
+        /**
+         *  Adds @l to the listeners of @local_ep, new connections to it are
+         *  split among them as @balance says, the first one to join decides.
+         *  Returns the id unlisten() takes.
+         */
+        uint64_t listen_reuseport(endpoint const& local_ep, reuseport_balance balance, listener l);
+
+        void unlisten(uint64_t id);
+
         void process(tcp_packet&& pkt_in) override;
+
+        /**
+         *  Makes this the tcb_manager of one shard: segments of connections
+         *  owned by other shards are forwarded to them, and connections
+         *  initiated here get a local port that keeps them on this shard
+         */
+        void set_shards(shard_map shards);
+
+        size_t shard_of(two_ends_t const& two_end) const;
+        size_t shard_self() const { return shards_.self; }
+        bool   sharded() const { return shards_.count > 1; }
+
+        /**
+         *  Marks the calling thread as the one running this shard
+         */
+        void bind_this_thread() const { this_thread_shard_ = shards_.self; }
+
+        /**
+         *  Shard whose thread is the calling one, kNoShard for any other thread
+         */
+        static size_t this_thread_shard() { return this_thread_shard_; }
+
+        /**
+         *  A segment forwarded by shard @from
+         */
+        void process_forwarded(tcp_packet&& pkt_in, size_t from);
+
+        /**
+         *  Takes over a connection another shard has moved here, see
+         *  tcb_t::steer_here(). The shard that set a connection up keeps it in its
+         *  table wherever it moves, so that segments for it reaching other shards
+         *  have somewhere to be sent on from.
+         */
+        void adopt(std::shared_ptr<tcb_t> tcb);
+
+        void submit(size_t to, task fn);
+
+        /**
+         *  Forgets @tcb once it is closed, in the table of the shard that set it
+         *  up as well. Called on the thread of the shard it belongs to.
+         */
+        void remove(tcb_t const& tcb);
+
+        boost::asio::io_context& io_context() noexcept { return io_ctx_; }
+
+        skb_pool& pool() noexcept { return *pool_; }
+
+        /**
+         *  Algorithm connections set up from now on start with, NewReno unless
+         *  set otherwise
+         */
+        void         set_congestion_control(cc_algorithm algo) { cc_default_ = algo; }
+        cc_algorithm default_congestion_control() const { return cc_default_; }
+
+        /**
+         *  Timers of the connections of this shard, run on its thread
+         */
+        timer_wheel& timers() noexcept { return timers_; }
+
+        /**
+         *  MSS that fits the MTU of the device @addr is routed through
+         */
+        uint16_t mss_to(ipv4_addr_t const& addr) const;
+
+        /**
+         *  Device @addr is routed through, nullptr if there is no route
+         */
+        std::shared_ptr<device> tx_device(ipv4_addr_t const& addr) const;
+
+        /**
+         *  true if segments would only pile up: the queue down to tcp or the
+         *  TX queue of @dev, from tx_device(), is full
+         */
+        bool tx_backlogged(device const* dev) const;
+
+        /**
+         *  Has @tcb send again once the backlog has cleared
+         */
+        void wait_tx(std::weak_ptr<tcb_t> tcb);
+
+        /**
+         *  Called when a backlog has cleared, the waiting connections send again
+         */
+        void resume_tx();
+
+        /**
+         *  true while the shards this one forwards segments to are behind, its
+         *  devices stop receiving meanwhile
+         */
+        bool forward_backlogged() const;
+
+        /**
+         *  Has @dev receive again once the shards forwarded to have caught up
+         */
+        void wait_rx(std::weak_ptr<device> dev);
+
+        /**
+         *  Called once the shards forwarded to have caught up
+         */
+        void resume_rx();
 };
 
 }  // namespace mstack
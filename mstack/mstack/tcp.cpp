@@ -13,8 +13,10 @@
 #include <spdlog/spdlog.h>
 
 #include "mstack/tcp_packet.hpp"
+#include "offload.hpp"
 #include "packets.hpp"
 #include "tcp_header.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 namespace mstack {
@@ -31,36 +33,26 @@ void tcp::process_raw(tcp_packet&& pkt_in) {
 }
 
 void tcp::process(tcp_packet&& pkt_in) {
-        spdlog::debug("[TCP] HDL FROM U-LAYER {}", pkt_in);
+        MSTACK_TRACE_EVENT(tcp_tx, pkt_in.proto,
+                           pkt_in.local_ep.addrv4_port << 16 | pkt_in.remote_ep.addrv4_port, 0,
+                           pkt_in.skb.len());
 
         assert(!(pkt_in.skb.payload().size() < tcp_header_t::fixed_size()));
 
-        std::memset(pkt_in.skb.head() + offsetof(tcp_header_t, chsum), 0x00,
-                    sizeof(tcp_header_t::chsum));
-
-        struct tcp_pseudo_header {
-                uint32_t src_addrv4;
-                uint32_t dst_addrv4;
-                uint8_t  reserved;
-                uint8_t  proto;
-                uint16_t segment_len;
-        } const tcp_ph_net = {
-                .src_addrv4  = utils::hton(pkt_in.local_ep.addrv4.raw()),
-                .dst_addrv4  = utils::hton(pkt_in.remote_ep.addrv4.raw()),
-                .reserved    = 0,
-                .proto       = pkt_in.proto,
-                .segment_len = utils::hton(static_cast<uint16_t>(pkt_in.skb.payload().size())),
+        // only the pseudo header goes to the checksum here, the device completes it
+        // either in software or by handing it to the TAP along with the frame
+        auto const chsum_net{
+                pseudo_header_sum(pkt_in.local_ep.addrv4, pkt_in.remote_ep.addrv4, pkt_in.proto,
+                                  static_cast<uint16_t>(pkt_in.skb.len())),
         };
-
-        assert(!(pkt_in.skb.headroom() < sizeof(tcp_ph_net)));
-        pkt_in.skb.push_front(sizeof(tcp_ph_net));
-        std::memcpy(pkt_in.skb.head(), &tcp_ph_net, sizeof(tcp_ph_net));
-
-        decltype(tcp_header_t::chsum) const chsum_net{utils::checksum(pkt_in.skb.payload())};
-        pkt_in.skb.pop_front(sizeof(tcp_ph_net));
         std::memcpy(pkt_in.skb.head() + offsetof(tcp_header_t, chsum), &chsum_net,
                     sizeof(chsum_net));
 
+        auto& offload{pkt_in.skb.offload()};
+        offload.csum_partial = true;
+        offload.csum_start   = static_cast<uint16_t>(pkt_in.skb.headroom());
+        offload.csum_offset  = offsetof(tcp_header_t, chsum);
+
         process_raw(std::move(pkt_in));
 }
 
@@ -68,7 +60,10 @@ std::optional<tcp_packet> tcp::make_packet(ipv4_packet&& pkt_in) {
         assert(!(pkt_in.skb.payload().size() < tcp_header_t::fixed_size()));
         auto const tcp_fixed_header{tcp_header_t::consume_from_net(pkt_in.skb.head())};
 
-        spdlog::debug("[TCP] RECEIVE {}", tcp_fixed_header);
+        MSTACK_TRACE_EVENT(tcp_rx, tcp_fixed_header.flags(),
+                           tcp_fixed_header.src_port << 16 | tcp_fixed_header.dst_port,
+                           tcp_fixed_header.seq_no,
+                           uint64_t{tcp_fixed_header.ack_no} << 32 | pkt_in.skb.len());
 
         auto tcp_pkt = tcp_packet{
                 .proto = PROTO,
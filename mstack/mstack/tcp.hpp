@@ -2,6 +2,7 @@
 
 #include <deque>
 #include <functional>
+#include <queue>
 #include <unordered_map>
 
 #include <boost/asio/io_context.hpp>
@@ -15,7 +16,9 @@
 
 namespace mstack {
 
-class tcp : public base_protocol<ipv4_packet, tcp_packet> {
+class tcb_manager;
+
+class tcp final : public base_protocol<ipv4_packet, tcp_packet, upper_proto<0x06, tcb_manager>> {
 private:
         struct raw_state {
                 std::queue<tcp_packet>                        pq;
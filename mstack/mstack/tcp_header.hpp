@@ -62,14 +62,17 @@ struct tcp_header_t {
                 return tcp_header;
         }
 
+        uint8_t flags() const {
+                return CWR << 7 | ECE << 6 | URG << 5 | ACK << 4 | PSH << 3 | RST << 2 | SYN << 1 |
+                       FIN;
+        }
+
         std::byte* produce_to_net(std::byte* ptr) const {
                 utils::produce_to_net(ptr, src_port);
                 utils::produce_to_net(ptr, dst_port);
                 utils::produce_to_net(ptr, seq_no);
                 utils::produce_to_net(ptr, ack_no);
-                utils::produce_to_net<uint16_t>(ptr, data_offset << 12 | CWR << 7 | ECE << 6 |
-                                                             URG << 5 | ACK << 4 | PSH << 3 |
-                                                             RST << 2 | SYN << 1 | FIN);
+                utils::produce_to_net<uint16_t>(ptr, data_offset << 12 | flags());
                 utils::produce_to_net(ptr, window);
                 utils::produce_to_net(ptr, chsum);
                 utils::produce_to_net(ptr, urgent_pointer);
@@ -0,0 +1,202 @@
+#include "timer_wheel.hpp"
+
+#include <cassert>
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+#include <boost/system/error_code.hpp>
+
+namespace mstack {
+
+namespace {
+
+constexpr size_t kSlotBits{8};
+
+constexpr uint64_t slot_index(uint64_t tick, size_t level) {
+        return tick >> (kSlotBits * level) & (timer_wheel::kSlots - 1);
+}
+
+}  // namespace
+
+timer_wheel::timer_wheel(boost::asio::io_context& io_ctx) : timer_(io_ctx), epoch_(clock::now()) {}
+
+timer_wheel::~timer_wheel() noexcept {
+        for (auto& head : slots_) {
+                while (head.next != &head) {
+                        auto& t{static_cast<timer&>(*head.next)};
+                        unlink(t);
+                        t.wheel_ = nullptr;
+                }
+        }
+}
+
+uint64_t timer_wheel::tick_of(clock::time_point tp) const {
+        return static_cast<uint64_t>(std::max(tp - epoch_, clock::duration::zero()) / kTick);
+}
+
+void timer_wheel::arm(timer& t, clock::duration delay) {
+        if (t.wheel_) cancel(t);
+
+        auto const now{clock::now()};
+        // catch up first, a wheel idle for a while still stands where it went idle
+        if (0 == size_) current_ = std::max(current_, tick_of(now));
+
+        // the first tick starting at or after the deadline, never early
+        auto const deadline{now - epoch_ + std::max(delay, clock::duration::zero())};
+        t.wheel_  = this;
+        t.expiry_ = static_cast<uint64_t>((deadline + kTick - clock::duration{1}) / kTick);
+        insert(t);
+        ++size_;
+
+        if (t.expiry_ < wakeup_) schedule();
+}
+
+void timer_wheel::cancel(timer& t) {
+        if (this != t.wheel_) return;
+
+        unlink(t);
+        t.wheel_ = nullptr;
+        --size_;
+}
+
+void timer_wheel::insert(timer& t) {
+        auto const delta{t.expiry_ > current_ ? t.expiry_ - current_ : 0};
+
+        size_t level{0};
+        while (level + 1 < kLevels && !(delta < uint64_t{1} << (kSlotBits * (level + 1))))
+                ++level;
+
+        // beyond the top level it waits in the furthest slot and cascades again
+        auto const span{uint64_t{1} << (kSlotBits * kLevels)};
+        auto const expiry{std::min(t.expiry_, current_ + span - 1)};
+        auto const index{slot_index(std::max(expiry, current_), level)};
+
+        t.slot_ = static_cast<uint16_t>(level * kSlots + index);
+
+        auto& head{slots_[t.slot_]};
+        t.prev          = head.prev;
+        t.next          = &head;
+        head.prev->next = &t;
+        head.prev       = &t;
+
+        occupied_[level][index / 64] |= uint64_t{1} << (index % 64);
+}
+
+void timer_wheel::unlink(timer& t) {
+        t.prev->next = t.next;
+        t.next->prev = t.prev;
+
+        if (auto& head{slots_[t.slot_]}; head.next == &head) {
+                auto const level{t.slot_ / kSlots};
+                auto const index{t.slot_ % kSlots};
+                occupied_[level][index / 64] &= ~(uint64_t{1} << (index % 64));
+        }
+
+        t.prev = t.next = &t;
+}
+
+void timer_wheel::advance() {
+        auto const now{tick_of(clock::now())};
+        while (!(current_ > now)) {
+                // nothing left to run, skip to now
+                if (0 == size_) {
+                        current_ = now + 1;
+                        break;
+                }
+                run_tick();
+        }
+}
+
+void timer_wheel::run_tick() {
+        auto const index{slot_index(current_, 0)};
+        if (0 == index) {
+                for (size_t level{1}; level < kLevels; ++level) {
+                        auto const i{slot_index(current_, level)};
+                        cascade(level, i);
+                        if (0 != i) break;
+                }
+        }
+
+        // taken off the wheel before anything fires, so that timers re-armed
+        // from a callback land in a later tick
+        link expired;
+        auto& head{slots_[index]};
+        if (head.next != &head) {
+                expired.next       = head.next;
+                expired.prev       = head.prev;
+                head.next->prev    = &expired;
+                head.prev->next    = &expired;
+                head.next          = head.prev = &head;
+                occupied_[0][index / 64] &= ~(uint64_t{1} << (index % 64));
+        }
+        ++current_;
+
+        while (expired.next != &expired) {
+                auto& t{static_cast<timer&>(*expired.next)};
+                t.prev->next = t.next;
+                t.next->prev = t.prev;
+                t.prev = t.next = &t;
+                t.wheel_        = nullptr;
+                --size_;
+                t.fn_();
+        }
+}
+
+void timer_wheel::cascade(size_t level, size_t index) {
+        auto& head{slots_[level * kSlots + index]};
+
+        link moving;
+        if (head.next == &head) return;
+        moving.next     = head.next;
+        moving.prev     = head.prev;
+        head.next->prev = &moving;
+        head.prev->next = &moving;
+        head.next = head.prev = &head;
+        occupied_[level][index / 64] &= ~(uint64_t{1} << (index % 64));
+
+        while (moving.next != &moving) {
+                auto& t{static_cast<timer&>(*moving.next)};
+                t.prev->next = t.next;
+                t.next->prev = t.prev;
+                insert(t);
+        }
+}
+
+uint64_t timer_wheel::next_tick() const {
+        if (0 == size_) return kNever;
+
+        // the next busy slot of level 0 before it wraps around, or else the
+        // wrap itself, which cascades the levels above
+        auto const from{slot_index(current_, 0)};
+        if (0 == from) return current_;
+        for (auto word{from / 64}; word < kSlots / 64; ++word) {
+                auto bits{occupied_[0][word]};
+                if (word == from / 64) bits &= ~uint64_t{0} << (from % 64);
+                if (0 != bits)
+                        return current_ - from + word * 64 +
+                               static_cast<uint64_t>(std::countr_zero(bits));
+        }
+        return current_ - from + kSlots;
+}
+
+void timer_wheel::schedule() {
+        wakeup_ = next_tick();
+        if (kNever == wakeup_) {
+                timer_.cancel();
+                return;
+        }
+
+        timer_.expires_at(epoch_ + wakeup_ * kTick);
+        timer_.async_wait([this, wakeup = wakeup_](boost::system::error_code const& ec) {
+                // superseded by an earlier wakeup
+                if (ec || wakeup != wakeup_) return;
+                // timers armed while firing wait for the schedule() below
+                wakeup_ = 0;
+                advance();
+                schedule();
+        });
+}
+
+}  // namespace mstack
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <limits>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace mstack {
+
+/**
+ *  Per-netns timers on a hierarchical timing wheel: four levels of 256 slots,
+ *  a slot of level n spanning 256^n ticks of 1 ms. A timer sits in the slot
+ *  of the level its expiry falls in and moves down a level each time the one
+ *  below wraps around, so arming and cancelling are O(1) and firing costs a
+ *  few list moves per timer no matter how many are armed. A single
+ *  steady_timer wakes the wheel up, only for ticks it has timers for.
+ */
+class timer_wheel {
+private:
+        struct link {
+                link* prev{this};
+                link* next{this};
+        };
+
+public:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr auto   kTick{std::chrono::milliseconds{1}};
+        static constexpr size_t kLevels{4};
+        static constexpr size_t kSlots{256};
+
+        /**
+         *  Embedded in whatever it times, it never allocates. Arming an armed
+         *  timer moves it.
+         */
+        class timer : private link {
+        public:
+                explicit timer(std::function<void()> fn) : fn_(std::move(fn)) {}
+                ~timer() noexcept {
+                        if (wheel_) wheel_->cancel(*this);
+                }
+
+                timer(timer const&)            = delete;
+                timer& operator=(timer const&) = delete;
+
+                timer(timer&&)            = delete;
+                timer& operator=(timer&&) = delete;
+
+                bool armed() const { return nullptr != wheel_; }
+
+        private:
+                friend class timer_wheel;
+
+                std::function<void()> fn_;
+                timer_wheel*          wheel_{nullptr};
+                uint64_t              expiry_{0};
+                uint16_t              slot_{0};
+        };
+
+        explicit timer_wheel(boost::asio::io_context& io_ctx);
+        ~timer_wheel() noexcept;
+
+        timer_wheel(timer_wheel const&)            = delete;
+        timer_wheel& operator=(timer_wheel const&) = delete;
+
+        timer_wheel(timer_wheel&&)            = delete;
+        timer_wheel& operator=(timer_wheel&&) = delete;
+
+        /**
+         *  Has @t fire once @delay has passed, at the first tick after
+         */
+        void arm(timer& t, clock::duration delay);
+
+        void cancel(timer& t);
+
+        size_t size() const { return size_; }
+
+private:
+        static constexpr uint64_t kNever{std::numeric_limits<uint64_t>::max()};
+
+        uint64_t tick_of(clock::time_point tp) const;
+
+        void insert(timer& t);
+
+        void unlink(timer& t);
+
+        /**
+         *  Fires what has expired up to now
+         */
+        void advance();
+
+        void run_tick();
+
+        void cascade(size_t level, size_t index);
+
+        /**
+         *  The tick the wheel next has work at, kNever if it is empty
+         */
+        uint64_t next_tick() const;
+
+        void schedule();
+
+        boost::asio::steady_timer timer_;
+        clock::time_point         epoch_;
+        // the next tick to run
+        uint64_t current_{0};
+        uint64_t wakeup_{kNever};
+        size_t   size_{0};
+
+        std::array<link, kLevels * kSlots>                      slots_;
+        std::array<std::array<uint64_t, kSlots / 64>, kLevels> occupied_{};
+};
+
+}  // namespace mstack
@@ -0,0 +1,211 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <format>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+namespace mstack::trace {
+
+namespace {
+
+constexpr uint64_t kDumpMagic{0x3145434152544d53};  // "SMTRACE1"
+
+struct registry {
+        std::mutex                         mtx;
+        std::vector<std::unique_ptr<ring>> rings;
+};
+
+// never destroyed, threads may still be tracing while the process exits
+registry& rings() {
+        static auto* const reg{new registry};
+        return *reg;
+}
+
+template <typename T>
+void put(std::ostream& out, T const& v) {
+        out.write(reinterpret_cast<char const*>(&v), sizeof(v));
+}
+
+template <typename T>
+bool get(std::istream& in, T& v) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&v), sizeof(v)));
+}
+
+std::string ipv4_str(uint32_t addr) {
+        return std::format("{}.{}.{}.{}", addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+                           addr & 0xff);
+}
+
+std::string ports_str(uint32_t ports) {
+        return std::format("{} -> {}", ports >> 16, ports & 0xffff);
+}
+
+std::string tcp_flags_str(uint16_t flags) {
+        static constexpr char kNames[]{"CEUAPRSF"};
+
+        std::string s;
+        for (int bit{7}; bit >= 0; --bit)
+                s += flags & (1 << bit) ? kNames[7 - bit] : '.';
+        return s;
+}
+
+std::string describe(trace_record const& rec) {
+        auto const ack{static_cast<uint32_t>(rec.arg3 >> 32)};
+        auto const len{static_cast<uint32_t>(rec.arg3)};
+
+        switch (static_cast<trace_event>(rec.event)) {
+                case trace_event::dev_rx:
+                        return std::format("DEV {:#x} RX {} FRAMES {} BYTES", rec.arg3, rec.arg0,
+                                           rec.arg1);
+                case trace_event::dev_tx:
+                        return std::format("DEV {:#x} TX {} FRAMES {} LEFT", rec.arg3, rec.arg0,
+                                           rec.arg1);
+                case trace_event::dev_tx_drop:
+                        return std::format("DEV {:#x} TX DROP DEPTH {}", rec.arg3, rec.arg1);
+                case trace_event::eth_rx:
+                case trace_event::eth_tx:
+                        return std::format("ETH {} TYPE {:#06x} LEN {}",
+                                           trace_event::eth_rx == trace_event{rec.event} ? "RX"
+                                                                                          : "TX",
+                                           rec.arg0, rec.arg1);
+                case trace_event::ipv4_rx:
+                case trace_event::ipv4_tx:
+                        return std::format("IPV4 {} {} -> {} PROTO {} LEN {}",
+                                           trace_event::ipv4_rx == trace_event{rec.event} ? "RX"
+                                                                                           : "TX",
+                                           ipv4_str(rec.arg1), ipv4_str(rec.arg2), rec.arg0,
+                                           rec.arg3);
+                case trace_event::tcp_rx:
+                        return std::format("TCP RX {} [{}] SEQ {} ACK {} LEN {}",
+                                           ports_str(rec.arg1), tcp_flags_str(rec.arg0), rec.arg2,
+                                           ack, len);
+                case trace_event::tcp_tx:
+                        return std::format("TCP TX {} PROTO {} LEN {}", ports_str(rec.arg1),
+                                           rec.arg0, rec.arg3);
+                case trace_event::tcb_rx:
+                case trace_event::tcb_tx:
+                        return std::format("TCB {} {} STATE {} SEQ {} ACK {} LEN {}",
+                                           trace_event::tcb_rx == trace_event{rec.event} ? "RX"
+                                                                                          : "TX",
+                                           ports_str(rec.arg1), rec.arg0, rec.arg2, ack, len);
+                case trace_event::proto_unknown:
+                        return std::format("UNKNOWN PROTO {:#06x}", rec.arg0);
+        }
+        return std::format("EVENT {} {} {} {} {}", rec.event, rec.arg0, rec.arg1, rec.arg2,
+                           rec.arg3);
+}
+
+}  // namespace
+
+std::vector<trace_record> ring::snapshot() const {
+        auto const head{head_.load(std::memory_order_acquire)};
+        auto const first{head > kRecords ? head - kRecords : 0};
+
+        std::vector<trace_record> out;
+        out.reserve(head - first);
+        for (auto pos{first}; pos != head; ++pos) {
+                auto const& s{slots_[pos & (kRecords - 1)]};
+
+                // the writer may have lapped the copy meanwhile, whatever it is
+                // writing or has written over is left out
+                auto const version{s.version.load(std::memory_order_acquire)};
+                if (2 * pos + 2 != version) continue;
+
+                std::array<uint64_t, kWords> words;
+                for (size_t i{0}; i < kWords; ++i)
+                        words[i] = s.words[i].load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (version != s.version.load(std::memory_order_relaxed)) continue;
+
+                out.push_back(std::bit_cast<trace_record>(words));
+        }
+        return out;
+}
+
+ring& attach() {
+        if (this_thread_ring) return *this_thread_ring;
+
+        auto r{std::make_unique<ring>(static_cast<uint64_t>(::syscall(SYS_gettid)))};
+
+        auto& reg{rings()};
+        std::lock_guard lock{reg.mtx};
+        reg.rings.push_back(std::move(r));
+        this_thread_ring = reg.rings.back().get();
+        return *this_thread_ring;
+}
+
+ring* try_attach() noexcept {
+        try {
+                return &attach();
+        } catch (...) {
+                return nullptr;
+        }
+}
+
+void dump(std::string_view path) {
+        std::ofstream out{std::string{path}, std::ios::binary | std::ios::trunc};
+        if (!out) throw std::runtime_error{std::format("[TRACE] OPEN {} FAIL", path)};
+
+        auto& reg{rings()};
+        std::lock_guard lock{reg.mtx};
+
+        put(out, kDumpMagic);
+        put(out, static_cast<uint64_t>(reg.rings.size()));
+        for (auto const& r : reg.rings) {
+                auto const records{r->snapshot()};
+                put(out, r->tid());
+                put(out, static_cast<uint64_t>(records.size()));
+                out.write(reinterpret_cast<char const*>(records.data()),
+                          static_cast<std::streamsize>(records.size() * sizeof(trace_record)));
+        }
+
+        if (!out) throw std::runtime_error{std::format("[TRACE] WRITE {} FAIL", path)};
+}
+
+void decode(std::istream& in, std::ostream& out) {
+        uint64_t magic{0};
+        uint64_t nrings{0};
+        if (!get(in, magic) || kDumpMagic != magic || !get(in, nrings))
+                throw std::runtime_error{"[TRACE] NOT A TRACE DUMP"};
+
+        struct entry {
+                uint64_t     tid;
+                trace_record rec;
+        };
+        std::vector<entry> entries;
+
+        for (uint64_t i{0}; i < nrings; ++i) {
+                uint64_t tid{0};
+                uint64_t nrecords{0};
+                if (!get(in, tid) || !get(in, nrecords))
+                        throw std::runtime_error{"[TRACE] TRUNCATED DUMP"};
+                for (uint64_t j{0}; j < nrecords; ++j) {
+                        trace_record rec;
+                        if (!get(in, rec)) throw std::runtime_error{"[TRACE] TRUNCATED DUMP"};
+                        entries.push_back({tid, rec});
+                }
+        }
+
+        std::ranges::stable_sort(entries, {}, [](entry const& e) { return e.rec.ts_ns; });
+
+        auto const t0{entries.empty() ? 0 : entries.front().rec.ts_ns};
+        for (auto const& [tid, rec] : entries)
+                out << std::format("{:>14.3f} {:>7} {}\n", (rec.ts_ns - t0) / 1e3, tid,
+                                   describe(rec));
+}
+
+}  // namespace mstack::trace
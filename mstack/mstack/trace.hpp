@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <iosfwd>
+#include <string_view>
+#include <vector>
+
+namespace mstack {
+
+/**
+ *  What a trace record stands for, which also tells what its args hold:
+ *
+ *  dev_rx        arg0 frames, arg1 bytes, arg3 device
+ *  dev_tx        arg0 frames sent, arg1 frames left queued, arg3 device
+ *  dev_tx_drop   arg1 queue depth, arg3 device
+ *  eth_rx/tx     arg0 ethertype, arg1 length
+ *  ipv4_rx/tx    arg0 protocol, arg1 source, arg2 destination, arg3 length
+ *  tcp_rx        arg0 flags, arg1 ports, arg2 seq, arg3 ack << 32 | length
+ *  tcp_tx        arg0 protocol, arg1 ports, arg3 length
+ *  tcb_rx        arg0 state, arg1 ports, arg2 seq, arg3 ack << 32 | length
+ *  tcb_tx        arg0 state, arg1 ports, arg2 seq, arg3 ack << 32 | length
+ *  proto_unknown arg0 protocol
+ *
+ *  Ports are source << 16 | destination as seen by the packet.
+ */
+enum class trace_event : uint16_t {
+        dev_rx,
+        dev_tx,
+        dev_tx_drop,
+        eth_rx,
+        eth_tx,
+        ipv4_rx,
+        ipv4_tx,
+        tcp_rx,
+        tcp_tx,
+        tcb_rx,
+        tcb_tx,
+        proto_unknown,
+};
+
+struct trace_record {
+        uint64_t ts_ns;
+        // low bits of the position in the ring, for a reader to tell records
+        // overwritten while it was copying them
+        uint32_t seq;
+        uint16_t event;
+        uint16_t arg0;
+        uint32_t arg1;
+        uint32_t arg2;
+        uint64_t arg3;
+};
+static_assert(32 == sizeof(trace_record));
+
+namespace trace {
+
+/**
+ *  Records of one thread, the oldest are overwritten once it is full. Only the
+ *  owning thread writes, and it never waits for anyone.
+ */
+class ring {
+public:
+        static constexpr size_t kRecords{64 * 1024};
+
+        explicit ring(uint64_t tid) : tid_(tid) {}
+
+        /**
+         *  A seqlock per slot: the version is odd while the slot is written,
+         *  so a reader can tell a record it raced with
+         */
+        void write(trace_record rec) noexcept {
+                auto const head{head_.load(std::memory_order_relaxed)};
+                rec.seq = static_cast<uint32_t>(head);
+
+                auto& s{slots_[head & (kRecords - 1)]};
+                s.version.store(2 * head + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                auto const words{std::bit_cast<std::array<uint64_t, kWords>>(rec)};
+                for (size_t i{0}; i < kWords; ++i)
+                        s.words[i].store(words[i], std::memory_order_relaxed);
+                s.version.store(2 * head + 2, std::memory_order_release);
+
+                head_.store(head + 1, std::memory_order_release);
+        }
+
+        /**
+         *  What the ring holds, oldest first, records overwritten while they
+         *  were being copied are left out
+         */
+        std::vector<trace_record> snapshot() const;
+
+        uint64_t tid() const { return tid_; }
+
+private:
+        static constexpr size_t kWords{sizeof(trace_record) / sizeof(uint64_t)};
+
+        struct slot {
+                // 2 * position + 2 once the record at position is written
+                std::atomic<uint64_t>                     version{0};
+                std::array<std::atomic<uint64_t>, kWords> words{};
+        };
+
+        uint64_t                          tid_;
+        alignas(64) std::atomic<uint64_t> head_{0};
+        std::array<slot, kRecords>        slots_{};
+};
+
+inline thread_local ring* this_thread_ring{nullptr};
+
+/**
+ *  Creates the ring of the calling thread unless it has one, it outlives the
+ *  thread so that its records can still be dumped. Threads on the packet path
+ *  call it when they start, record() only falls back to it for the others.
+ */
+ring& attach();
+
+/**
+ *  attach() for record(), nullptr if the ring could not be had
+ */
+ring* try_attach() noexcept;
+
+inline void record(trace_event ev,
+                   uint64_t    arg0 = 0,
+                   uint64_t    arg1 = 0,
+                   uint64_t    arg2 = 0,
+                   uint64_t    arg3 = 0) noexcept {
+        auto* r{this_thread_ring};
+        if (!r) [[unlikely]] {
+                // the event is lost, tracing never fails the packet path
+                r = try_attach();
+                if (!r) return;
+        }
+        r->write({
+                .ts_ns = static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch())
+                                .count()),
+                .seq   = 0,
+                .event = static_cast<uint16_t>(ev),
+                .arg0  = static_cast<uint16_t>(arg0),
+                .arg1  = static_cast<uint32_t>(arg1),
+                .arg2  = static_cast<uint32_t>(arg2),
+                .arg3  = arg3,
+        });
+}
+
+/**
+ *  Writes the records of all threads to @path, for decode() to read
+ */
+void dump(std::string_view path);
+
+/**
+ *  Prints the records of a dump read from @in to @out, one line each, all
+ *  threads merged in time order
+ */
+void decode(std::istream& in, std::ostream& out);
+
+}  // namespace trace
+
+}  // namespace mstack
+
+/**
+ *  Records a trace_event::@ev on the packet path. Builds without MSTACK_TRACE
+ *  compile it away along with its arguments.
+ */
+#ifdef MSTACK_TRACE
+#define MSTACK_TRACE_EVENT(ev, ...) \
+        ::mstack::trace::record(::mstack::trace_event::ev __VA_OPT__(, ) __VA_ARGS__)
+#else
+#define MSTACK_TRACE_EVENT(ev, ...) ((void)0)
+#endif
@@ -0,0 +1,377 @@
+#include "uring_engine.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#include <linux/if_tun.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/asio/error.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include "device.hpp"
+#include "skbuff.hpp"
+#include "tap_engine.hpp"
+
+namespace mstack {
+
+namespace {
+
+constexpr uint16_t kRxBufGroup{0};
+
+constexpr uint64_t kRxTag{1ull << 32};
+constexpr uint64_t kTxTag{2ull << 32};
+constexpr uint64_t kBufTag{3ull << 32};
+
+template <typename T>
+T load_acquire(T* p) {
+        return std::atomic_ref<T>{*p}.load(std::memory_order_acquire);
+}
+
+template <typename T>
+void store_release(T* p, T v) {
+        std::atomic_ref<T>{*p}.store(v, std::memory_order_release);
+}
+
+}  // namespace
+
+/**
+ *  Minimal io_uring instance: the SQ/CQ rings mapped straight from the kernel
+ *  ABI
+ */
+class uring_engine::ring {
+public:
+        explicit ring(unsigned entries) {
+                io_uring_params params{};
+                fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+                if (fd_ < 0)
+                        throw std::runtime_error{
+                                std::format("[URING] SETUP FAIL {}", strerror(errno))};
+
+                sq_sz_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                cq_sz_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                if (params.features & IORING_FEAT_SINGLE_MMAP)
+                        sq_sz_ = cq_sz_ = std::max(sq_sz_, cq_sz_);
+
+                sq_ptr_ = mmap_ring(sq_sz_, IORING_OFF_SQ_RING);
+                cq_ptr_ = (params.features & IORING_FEAT_SINGLE_MMAP)
+                                  ? sq_ptr_
+                                  : mmap_ring(cq_sz_, IORING_OFF_CQ_RING);
+                sqes_sz_ = params.sq_entries * sizeof(io_uring_sqe);
+                sqes_    = static_cast<io_uring_sqe*>(mmap_ring(sqes_sz_, IORING_OFF_SQES));
+
+                auto* sq{static_cast<std::byte*>(sq_ptr_)};
+                sq_head_       = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                sq_tail_       = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                sq_mask_       = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                sq_entries_    = params.sq_entries;
+                sq_array_      = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                sq_tail_local_ = *sq_tail_;
+
+                auto* cq{static_cast<std::byte*>(cq_ptr_)};
+                cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                cqes_    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        }
+
+        ~ring() noexcept {
+                ::munmap(sqes_, sqes_sz_);
+                if (cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_sz_);
+                ::munmap(sq_ptr_, sq_sz_);
+                ::close(fd_);
+        }
+
+        ring(ring const&)            = delete;
+        ring& operator=(ring const&) = delete;
+
+        ring(ring&&)            = delete;
+        ring& operator=(ring&&) = delete;
+
+        void register_eventfd(int efd) {
+                if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+                        throw std::runtime_error{
+                                std::format("[URING] REGISTER EVENTFD FAIL {}", strerror(errno))};
+        }
+
+        io_uring_sqe* get_sqe() {
+                // a full SQ is pushed to the kernel early instead of failing the caller
+                if (!(sq_tail_local_ - load_acquire(sq_head_) < sq_entries_)) submit();
+                if (!(sq_tail_local_ - load_acquire(sq_head_) < sq_entries_)) return nullptr;
+                auto const idx{sq_tail_local_ & sq_mask_};
+                sq_array_[idx] = idx;
+                ++sq_tail_local_;
+                ++to_submit_;
+                auto* sqe{&sqes_[idx]};
+                std::memset(sqe, 0, sizeof(*sqe));
+                return sqe;
+        }
+
+        void submit() {
+                if (0 == to_submit_) return;
+                store_release(sq_tail_, sq_tail_local_);
+                while (to_submit_ > 0) {
+                        auto const ret{::syscall(__NR_io_uring_enter, fd_, to_submit_, 0, 0,
+                                                 nullptr, 0)};
+                        if (ret < 0) {
+                                if (EINTR == errno) continue;
+                                spdlog::warn("[URING] SUBMIT FAIL {}", strerror(errno));
+                                break;
+                        }
+                        to_submit_ -= static_cast<unsigned>(ret);
+                }
+        }
+
+        template <typename Callback>
+        void for_each_cqe(Callback&& cb) {
+                auto       head{*cq_head_};
+                auto const tail{load_acquire(cq_tail_)};
+                for (; head != tail; ++head)
+                        cb(cqes_[head & cq_mask_]);
+                store_release(cq_head_, head);
+        }
+
+private:
+        void* mmap_ring(size_t size, off_t offset) {
+                auto* p{::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               fd_, offset)};
+                if (MAP_FAILED == p)
+                        throw std::runtime_error{
+                                std::format("[URING] RING MAP FAIL {}", strerror(errno))};
+                return p;
+        }
+
+        int fd_;
+
+        void*         sq_ptr_{nullptr};
+        size_t        sq_sz_{0};
+        void*         cq_ptr_{nullptr};
+        size_t        cq_sz_{0};
+        io_uring_sqe* sqes_{nullptr};
+        size_t        sqes_sz_{0};
+
+        unsigned* sq_head_;
+        unsigned* sq_tail_;
+        unsigned  sq_mask_;
+        unsigned  sq_entries_;
+        unsigned* sq_array_;
+        unsigned  sq_tail_local_;
+        unsigned  to_submit_{0};
+
+        unsigned*     cq_head_;
+        unsigned*     cq_tail_;
+        unsigned      cq_mask_;
+        io_uring_cqe* cqes_;
+};
+
+uring_engine::uring_engine(boost::asio::io_context& io_ctx,
+                           skb_pool&                pool,
+                           std::string_view         name /* = ""*/,
+                           bool                     multi_queue /* = false*/)
+    : ring_(std::make_unique<ring>(kRingEntries)), efd_(io_ctx), pool_(pool) {
+        // io_uring arms its own poll on the fd, a blocking descriptor keeps reads
+        // waiting in the kernel rather than failing with EAGAIN
+        fd_ = tap_open(name, 0, ndev_, multi_queue ? IFF_MULTI_QUEUE : 0);
+
+        efd_.assign(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        ring_->register_eventfd(efd_.native_handle());
+
+        // buffers are sized after the MTU of the device, they are provided once
+        // the engine knows it
+        rx_bufs_.resize(kRxDepth);
+
+        // every posted read may come with a buffer being handed back, what is
+        // left of the ring is for writes
+        tx_inflight_.resize(kRingEntries - 2 * kRxDepth);
+        tx_free_slots_.resize(tx_inflight_.size());
+        std::iota(tx_free_slots_.rbegin(), tx_free_slots_.rend(), 0u);
+}
+
+uring_engine::~uring_engine() noexcept {
+        // tear the ring down first, the kernel must be done with the buffers
+        ring_.reset();
+        for (auto const buf : rx_bufs_)
+                if (!buf.empty()) pool_.release(buf.data(), buf.size());
+}
+
+std::string const& uring_engine::name() const { return ndev_; }
+
+void uring_engine::start(device& dev) {
+        dev_ = &dev;
+
+        for (uint16_t bid{0}; bid < kRxDepth; ++bid)
+                provide_buffer(bid);
+        for (unsigned i{0}; i < kRxDepth; ++i)
+                post_read();
+        ring_->submit();
+
+        async_wait_completions();
+}
+
+void uring_engine::resume_rx() {
+        for (; rx_unposted_ > 0; --rx_unposted_)
+                post_read();
+        ring_->submit();
+}
+
+void uring_engine::provide_buffer(uint16_t bid) {
+        assert(dev_);
+
+        // a new buffer follows MTU changes, the ones still provided keep the
+        // size they were acquired with
+        auto const size{dev_->rx_frame_size()};
+        rx_bufs_[bid] = {pool_.acquire(size), size};
+
+        auto* sqe{ring_->get_sqe()};
+        assert(sqe);
+        sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd        = 1;
+        sqe->addr      = reinterpret_cast<uint64_t>(rx_bufs_[bid].data());
+        sqe->len       = static_cast<uint32_t>(size);
+        sqe->off       = bid;
+        sqe->buf_group = kRxBufGroup;
+        sqe->user_data = kBufTag | bid;
+}
+
+void uring_engine::post_read() {
+        auto* sqe{ring_->get_sqe()};
+        assert(sqe);
+        sqe->opcode    = IORING_OP_READ;
+        sqe->fd        = fd_.get_fd();
+        sqe->off       = static_cast<uint64_t>(-1);
+        sqe->len       = static_cast<uint32_t>(dev_->rx_frame_size());
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kRxBufGroup;
+        sqe->user_data = kRxTag;
+}
+
+void uring_engine::async_wait_completions() {
+        efd_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                        [this](boost::system::error_code const& ec) {
+                                // the eventfd is closed with the engine, which is
+                                // gone by now
+                                if (boost::asio::error::operation_aborted == ec) return;
+
+                                if (ec) {
+                                        spdlog::warn("[DEV {}] URING WAIT FAIL {}", ndev_,
+                                                     ec.what());
+                                } else {
+                                        uint64_t cnt;
+                                        std::ignore = ::read(efd_.native_handle(), &cnt,
+                                                             sizeof(cnt));
+                                        reap_completions();
+                                }
+                                async_wait_completions();
+                        });
+}
+
+void uring_engine::reap_completions() {
+        assert(dev_);
+
+        bool tx_completed{false};
+
+        ring_->for_each_cqe([&](io_uring_cqe const& cqe) {
+                if (kRxTag == cqe.user_data) {
+                        if (cqe.res < 0) {
+                                if (-ENOBUFS != cqe.res) {
+                                        ++stats(*dev_).rx_errors;
+                                        spdlog::warn("[DEV {}] RECEIVE FAIL {}", ndev_,
+                                                     strerror(-cqe.res));
+                                }
+                        } else {
+                                assert(cqe.flags & IORING_CQE_F_BUFFER);
+                                auto const bid{static_cast<uint16_t>(cqe.flags >>
+                                                                     IORING_CQE_BUFFER_SHIFT)};
+                                auto const buf{std::exchange(rx_bufs_[bid], {})};
+                                auto skb{skbuff{pool_, buf.data(), buf.size(), 0, buf.size()}};
+                                skb.push_back(cqe.res);
+                                in_skbs_.push_back(std::move(skb));
+
+                                provide_buffer(bid);
+                        }
+                        // a paused device gets the read back with resume_rx()
+                        if (pause_rx(*dev_))
+                                ++rx_unposted_;
+                        else
+                                post_read();
+                } else if (kBufTag == (cqe.user_data & ~0xffffffffull)) {
+                        if (cqe.res < 0)
+                                spdlog::warn("[DEV {}] PROVIDE BUFFER FAIL {}", ndev_,
+                                             strerror(-cqe.res));
+                } else {
+                        assert(kTxTag == (cqe.user_data & ~0xffffffffull));
+                        auto const slot{static_cast<uint32_t>(cqe.user_data)};
+                        if (cqe.res < 0) {
+                                ++stats(*dev_).tx_errors;
+                                spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_, strerror(-cqe.res));
+                        } else {
+                                ++stats(*dev_).tx_packets;
+                                stats(*dev_).tx_bytes += cqe.res;
+                        }
+                        tx_inflight_[slot].reset();
+                        tx_free_slots_.push_back(slot);
+                        tx_completed = true;
+                }
+        });
+
+        ring_->submit();
+
+        for (std::span<skbuff> skbs{in_skbs_}; !skbs.empty();) {
+                auto const n{std::min(skbs.size(), dev_->rx_batch())};
+                deliver(*dev_, skbs.first(n));
+                skbs = skbs.subspan(n);
+        }
+        in_skbs_.clear();
+
+        if (tx_completed && tx_stalled_) {
+                tx_stalled_ = false;
+                resume_tx(*dev_);
+        }
+}
+
+size_t uring_engine::transmit(std::queue<skbuff>& skbs) {
+        size_t nframes{0};
+
+        while (!skbs.empty()) {
+                if (tx_free_slots_.empty()) break;
+
+                auto* sqe{ring_->get_sqe()};
+                if (!sqe) break;
+
+                auto const slot{tx_free_slots_.back()};
+                tx_free_slots_.pop_back();
+
+                auto& skb{tx_inflight_[slot].emplace(std::move(skbs.front()))};
+                skbs.pop();
+
+                auto const buf{skb.payload()};
+                sqe->opcode    = IORING_OP_WRITE;
+                sqe->fd        = fd_.get_fd();
+                sqe->off       = static_cast<uint64_t>(-1);
+                sqe->addr      = reinterpret_cast<uint64_t>(buf.data());
+                sqe->len       = static_cast<uint32_t>(buf.size());
+                sqe->user_data = kTxTag | slot;
+
+                ++nframes;
+        }
+
+        tx_stalled_ = !skbs.empty();
+
+        ring_->submit();
+
+        return nframes;
+}
+
+}  // namespace mstack
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <optional>
+#include <queue>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "device_engine.hpp"
+#include "file_desc.hpp"
+#include "skb_pool.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  Completion based engine on top of io_uring. A fixed number of reads with
+ *  kernel-selected buffers stays posted on the TAP fd all the time, the buffers
+ *  come from the netns pool and are passed up the stack without a copy. Writes
+ *  queued by a flush are submitted together with re-armed reads in a single
+ *  io_uring_enter(). Completions are signalled through an eventfd watched by
+ *  the io_context, so the engine shares the event loop with the rest of the
+ *  stack.
+ */
+class uring_engine : public device_engine {
+public:
+        static constexpr unsigned kRingEntries{256};
+        static constexpr unsigned kRxDepth{64};
+
+        explicit uring_engine(boost::asio::io_context& io_ctx,
+                              skb_pool&                pool,
+                              std::string_view         name        = "",
+                              bool                     multi_queue = false);
+        ~uring_engine() noexcept override;
+
+        std::string const& name() const override;
+
+        void start(device& dev) override;
+
+        size_t transmit(std::queue<skbuff>& skbs) override;
+
+        void resume_rx() override;
+
+private:
+        class ring;
+
+        void provide_buffer(uint16_t bid);
+
+        void post_read();
+
+        void async_wait_completions();
+
+        void reap_completions();
+
+        std::unique_ptr<ring>                 ring_;
+        file_desc                             fd_;
+        boost::asio::posix::stream_descriptor efd_;
+        skb_pool&                             pool_;
+        std::string                           ndev_;
+        device*                               dev_{nullptr};
+
+        std::vector<std::span<std::byte>> rx_bufs_;
+        std::vector<skbuff>               in_skbs_;
+        // reads completed while the device was paused and not posted again
+        unsigned rx_unposted_{0};
+
+        std::vector<std::optional<skbuff>> tx_inflight_;
+        std::vector<uint32_t>              tx_free_slots_;
+        bool                               tx_stalled_{false};
+};
+
+}  // namespace mstack
@@ -130,14 +130,16 @@ inline uint32_t sum_every_16bits(std::span<std::byte const> buf) {
         return sum;
 }
 
-inline uint16_t checksum(std::span<std::byte const> buf, uint32_t start_sum = 0) {
-        uint32_t sum = start_sum + sum_every_16bits(buf);
-
+inline uint16_t fold(uint32_t sum) {
         /*  Fold 32-bit sum to 16 bits */
         while (sum >> 16)
                 sum = (sum & 0xffff) + (sum >> 16);
 
-        return static_cast<uint16_t>(~sum);
+        return static_cast<uint16_t>(sum);
+}
+
+inline uint16_t checksum(std::span<std::byte const> buf, uint32_t start_sum = 0) {
+        return static_cast<uint16_t>(~fold(start_sum + sum_every_16bits(buf)));
 }
 
 }  // namespace utils
@@ -0,0 +1,449 @@
+#include "xsk_engine.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <span>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "device.hpp"
+#include "ethernet_header.hpp"
+#include "skb_pool.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+namespace {
+
+template <typename T>
+T load_acquire(T* p) {
+        return std::atomic_ref<T>{*p}.load(std::memory_order_acquire);
+}
+
+template <typename T>
+void store_release(T* p, T v) {
+        std::atomic_ref<T>{*p}.store(v, std::memory_order_release);
+}
+
+/**
+ *  One of the four single producer single consumer rings of an AF_XDP socket
+ *  mapped from the kernel ABI
+ */
+template <typename Desc>
+class xsk_ring {
+public:
+        xsk_ring(int fd, xdp_ring_offset const& off, uint32_t size, off_t pgoff)
+            : map_sz_(off.desc + size * sizeof(Desc)), mask_(size - 1), size_(size) {
+                auto* const map{::mmap(nullptr, map_sz_, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, fd, pgoff)};
+                if (MAP_FAILED == map)
+                        throw std::runtime_error{
+                                std::format("[XSK] RING MAP FAIL {}", strerror(errno))};
+                map_      = static_cast<std::byte*>(map);
+                producer_ = reinterpret_cast<uint32_t*>(map_ + off.producer);
+                consumer_ = reinterpret_cast<uint32_t*>(map_ + off.consumer);
+                descs_    = reinterpret_cast<Desc*>(map_ + off.desc);
+                prod_     = *producer_;
+                cons_     = *consumer_;
+        }
+
+        ~xsk_ring() noexcept { ::munmap(map_, map_sz_); }
+
+        xsk_ring(xsk_ring const&)            = delete;
+        xsk_ring& operator=(xsk_ring const&) = delete;
+
+        xsk_ring(xsk_ring&&)            = delete;
+        xsk_ring& operator=(xsk_ring&&) = delete;
+
+        // producer side: fill and TX rings
+        uint32_t free_slots() const { return size_ - (prod_ - load_acquire(consumer_)); }
+        Desc&    next(uint32_t i) { return descs_[(prod_ + i) & mask_]; }
+        void     submit(uint32_t n) { store_release(producer_, prod_ += n); }
+
+        // consumer side: RX and completion rings
+        uint32_t    ready() const { return load_acquire(producer_) - cons_; }
+        Desc const& peek(uint32_t i) const { return descs_[(cons_ + i) & mask_]; }
+        void        release(uint32_t n) { store_release(consumer_, cons_ += n); }
+
+private:
+        std::byte* map_;
+        size_t     map_sz_;
+        uint32_t*  producer_;
+        uint32_t*  consumer_;
+        Desc*      descs_;
+        uint32_t   mask_;
+        uint32_t   size_;
+        uint32_t   prod_;
+        uint32_t   cons_;
+};
+
+int bpf(int cmd, bpf_attr& attr) {
+        return static_cast<int>(::syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+}
+
+file_desc bpf_fd(int cmd, bpf_attr& attr, std::string_view what) {
+        auto fd{file_desc::from_fd(bpf(cmd, attr))};
+        if (!fd) throw std::runtime_error{std::format("[XSK] {} FAIL {}", what, strerror(errno))};
+        return std::move(*fd);
+}
+
+}  // namespace
+
+/**
+ *  The socket along with its UMEM and rings. Frames of the UMEM are owned by
+ *  skbuffs while they are on the stack's hands, a released frame goes straight
+ *  back to the fill ring while the kernel runs short of them and is kept for
+ *  transmission otherwise. Buffers asked for once the UMEM is exhausted come
+ *  from the heap.
+ */
+class xsk_engine::umem : public skb_allocator {
+public:
+        static constexpr uint32_t kFillTarget{kRingSize / 2};
+
+        umem()
+            : fd_(make_socket()),
+              region_(map_region()),
+              offsets_(mmap_offsets()),
+              fill_(fd_.get_fd(), offsets_.fr, kRingSize, XDP_UMEM_PGOFF_FILL_RING),
+              comp_(fd_.get_fd(), offsets_.cr, kRingSize, XDP_UMEM_PGOFF_COMPLETION_RING),
+              rx_(fd_.get_fd(), offsets_.rx, kRingSize, XDP_PGOFF_RX_RING),
+              tx_(fd_.get_fd(), offsets_.tx, kRingSize, XDP_PGOFF_TX_RING) {
+                free_.reserve(kFrames);
+                for (size_t i{kFrames}; i > 0; --i)
+                        free_.push_back(region_ + (i - 1) * kFrameSize);
+                refill();
+        }
+
+        ~umem() noexcept override { ::munmap(region_, kFrames * kFrameSize); }
+
+        int fd() { return fd_.get_fd(); }
+
+        bool owns(std::byte const* p) const {
+                return !(p < region_) && p < region_ + kFrames * kFrameSize;
+        }
+
+        uint64_t addr_of(std::byte const* p) const { return p - region_; }
+
+        std::byte* frame_of(uint64_t addr) const {
+                return region_ + (addr & ~static_cast<uint64_t>(kFrameSize - 1));
+        }
+
+        std::byte* take_frame() {
+                if (free_.empty()) return nullptr;
+                auto* const frame{free_.back()};
+                free_.pop_back();
+                return frame;
+        }
+
+        std::byte* acquire(size_t size) override {
+                if (!(size > kFrameSize))
+                        if (auto* const frame{take_frame()}) return frame;
+                return new std::byte[size];
+        }
+
+        void release(std::byte* buf, size_t size [[maybe_unused]]) noexcept override {
+                if (!owns(buf)) {
+                        delete[] buf;
+                        return;
+                }
+                free_.push_back(frame_of(addr_of(buf)));
+                refill();
+        }
+
+        void refill() {
+                auto const queued{kRingSize - fill_.free_slots()};
+                if (!(queued < kFillTarget)) return;
+                auto const n{std::min<uint32_t>(kFillTarget - queued, free_.size())};
+                for (uint32_t i{0}; i < n; ++i) {
+                        fill_.next(i) = addr_of(free_.back());
+                        free_.pop_back();
+                }
+                fill_.submit(n);
+        }
+
+        xsk_ring<uint64_t>& comp() { return comp_; }
+        xsk_ring<xdp_desc>& rx() { return rx_; }
+        xsk_ring<xdp_desc>& tx() { return tx_; }
+
+private:
+        static file_desc make_socket() {
+                auto fd{file_desc::from_fd(::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0))};
+                if (!fd)
+                        throw std::runtime_error{
+                                std::format("[XSK] SOCKET FAIL {}", strerror(errno))};
+                return std::move(*fd);
+        }
+
+        std::byte* map_region() {
+                auto* const region{::mmap(nullptr, kFrames * kFrameSize, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0)};
+                if (MAP_FAILED == region)
+                        throw std::runtime_error{
+                                std::format("[XSK] UMEM MAP FAIL {}", strerror(errno))};
+
+                xdp_umem_reg const reg{
+                        .addr       = reinterpret_cast<uint64_t>(region),
+                        .len        = kFrames * kFrameSize,
+                        .chunk_size = kFrameSize,
+                        .headroom   = 0,
+                        .flags      = 0,
+                };
+                set_option(XDP_UMEM_REG, reg, "UMEM REG");
+                set_option(XDP_UMEM_FILL_RING, kRingSize, "FILL RING");
+                set_option(XDP_UMEM_COMPLETION_RING, kRingSize, "COMPLETION RING");
+                set_option(XDP_RX_RING, kRingSize, "RX RING");
+                set_option(XDP_TX_RING, kRingSize, "TX RING");
+
+                return static_cast<std::byte*>(region);
+        }
+
+        xdp_mmap_offsets mmap_offsets() {
+                xdp_mmap_offsets offsets;
+                socklen_t        len{sizeof(offsets)};
+                if (::getsockopt(fd_.get_fd(), SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &len) < 0)
+                        throw std::runtime_error{
+                                std::format("[XSK] MMAP OFFSETS FAIL {}", strerror(errno))};
+                return offsets;
+        }
+
+        template <typename T>
+        void set_option(int opt, T const& value, std::string_view what) {
+                if (::setsockopt(fd_.get_fd(), SOL_XDP, opt, &value, sizeof(value)) < 0)
+                        throw std::runtime_error{
+                                std::format("[XSK] {} FAIL {}", what, strerror(errno))};
+        }
+
+        file_desc          fd_;
+        std::byte*         region_;
+        xdp_mmap_offsets   offsets_;
+        xsk_ring<uint64_t> fill_;
+        xsk_ring<uint64_t> comp_;
+        xsk_ring<xdp_desc> rx_;
+        xsk_ring<xdp_desc> tx_;
+
+        std::vector<std::byte*> free_;
+};
+
+xsk_engine::xsk_engine(boost::asio::io_context& io_ctx,
+                       std::string_view         name,
+                       uint32_t                 queue_id /* = 0*/)
+    : umem_(std::make_shared<umem>()), pfd_(io_ctx), ndev_(name), tx_inflight_(kFrames) {
+        auto const ifindex{::if_nametoindex(ndev_.c_str())};
+        if (0 == ifindex)
+                throw std::runtime_error{std::format("[XSK] NO DEV {} {}", ndev_, strerror(errno))};
+
+        sockaddr_xdp sxdp{};
+        sxdp.sxdp_family   = AF_XDP;
+        sxdp.sxdp_flags    = XDP_COPY;
+        sxdp.sxdp_ifindex  = ifindex;
+        sxdp.sxdp_queue_id = queue_id;
+        if (::bind(umem_->fd(), reinterpret_cast<sockaddr const*>(&sxdp), sizeof(sxdp)) < 0)
+                throw std::runtime_error{
+                        std::format("[XSK] BIND {} FAIL {}", ndev_, strerror(errno))};
+
+        bpf_attr map_attr{};
+        map_attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+        map_attr.key_size    = sizeof(uint32_t);
+        map_attr.value_size  = sizeof(uint32_t);
+        map_attr.max_entries = queue_id + 1;
+        xsks_map_            = bpf_fd(BPF_MAP_CREATE, map_attr, "XSKMAP CREATE");
+
+        auto const insn{[](uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+                bpf_insn i{};
+                i.code    = code;
+                i.dst_reg = dst & 0xf;
+                i.src_reg = src & 0xf;
+                i.off     = off;
+                i.imm     = imm;
+                return i;
+        }};
+
+        // r2 = ctx->rx_queue_index; return bpf_redirect_map(xsks_map, r2, XDP_PASS)
+        std::array<bpf_insn, 6> const insns{
+                insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1,
+                     offsetof(xdp_md, rx_queue_index), 0),
+                insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+                     xsks_map_.get_fd()),
+                // the upper half of the 64 bit immediate
+                insn(0, 0, 0, 0, 0),
+                insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+                insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+                insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        };
+
+        bpf_attr prog_attr{};
+        prog_attr.prog_type = BPF_PROG_TYPE_XDP;
+        prog_attr.insns     = reinterpret_cast<uint64_t>(insns.data());
+        prog_attr.insn_cnt  = insns.size();
+        prog_attr.license   = reinterpret_cast<uint64_t>("Dual MIT/GPL");
+        prog_ = bpf_fd(BPF_PROG_LOAD, prog_attr, "XDP PROG LOAD");
+
+        bpf_attr link_attr{};
+        link_attr.link_create.prog_fd        = static_cast<uint32_t>(prog_.get_fd());
+        link_attr.link_create.target_ifindex = ifindex;
+        link_attr.link_create.attach_type    = BPF_XDP;
+        link_attr.link_create.flags          = XDP_FLAGS_SKB_MODE;
+        link_ = bpf_fd(BPF_LINK_CREATE, link_attr, "XDP ATTACH");
+
+        uint32_t const key{queue_id};
+        uint32_t const value{static_cast<uint32_t>(umem_->fd())};
+        bpf_attr       elem_attr{};
+        elem_attr.map_fd = static_cast<uint32_t>(xsks_map_.get_fd());
+        elem_attr.key    = reinterpret_cast<uint64_t>(&key);
+        elem_attr.value  = reinterpret_cast<uint64_t>(&value);
+        if (bpf(BPF_MAP_UPDATE_ELEM, elem_attr) < 0)
+                throw std::runtime_error{
+                        std::format("[XSK] XSKMAP UPDATE FAIL {}", strerror(errno))};
+
+        // the socket itself belongs to the UMEM, which may outlive the engine
+        // while skbuffs hold its frames
+        pfd_.assign(::fcntl(umem_->fd(), F_DUPFD_CLOEXEC, 0));
+        pfd_.non_blocking(true);
+}
+
+xsk_engine::~xsk_engine() noexcept = default;
+
+std::string const& xsk_engine::name() const { return ndev_; }
+
+size_t xsk_engine::mtu_max() const {
+        // a frame has to fit into a single UMEM frame behind the XDP headroom
+        return kFrameSize - XDP_PACKET_HEADROOM - ethernetv2_header_t::size();
+}
+
+void xsk_engine::start(device& dev) {
+        dev_ = &dev;
+        in_skbs_.reserve(dev_->rx_batch());
+        async_receive();
+}
+
+void xsk_engine::async_receive() {
+        pfd_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+                        [this](boost::system::error_code const& ec) {
+                                if (ec) {
+                                        spdlog::warn("[DEV {}] RECEIVE FAIL {}", ndev_, ec.what());
+                                        async_receive();
+                                        return;
+                                }
+                                receive_batch();
+                                reap_completions();
+                                if (pause_rx(*dev_)) return;
+                                async_receive();
+                        });
+}
+
+void xsk_engine::resume_rx() { async_receive(); }
+
+void xsk_engine::receive_batch() {
+        assert(dev_);
+        assert(in_skbs_.empty());
+
+        auto& rx{umem_->rx()};
+
+        while (auto const ready{std::min<size_t>(rx.ready(), dev_->rx_batch())}) {
+                for (uint32_t i{0}; i < ready; ++i) {
+                        auto const& desc{rx.peek(i)};
+                        auto* const frame{umem_->frame_of(desc.addr)};
+                        auto const  headroom{
+                                static_cast<size_t>(desc.addr - umem_->addr_of(frame))};
+                        in_skbs_.emplace_back(*umem_, frame, kFrameSize, headroom,
+                                              kFrameSize - headroom - desc.len);
+                }
+                rx.release(ready);
+
+                deliver(*dev_, in_skbs_);
+                in_skbs_.clear();
+        }
+
+        umem_->refill();
+}
+
+void xsk_engine::reap_completions() {
+        auto& comp{umem_->comp()};
+
+        auto const ready{comp.ready()};
+        for (uint32_t i{0}; i < ready; ++i)
+                tx_inflight_[comp.peek(i) / kFrameSize].reset();
+        comp.release(ready);
+}
+
+size_t xsk_engine::transmit(std::queue<skbuff>& skbs) {
+        assert(dev_);
+
+        reap_completions();
+
+        if (tx_blocked_) return 0;
+
+        auto&      tx{umem_->tx()};
+        auto const slots{tx.free_slots()};
+
+        uint32_t nframes{0};
+        while (!skbs.empty() && nframes < slots) {
+                auto& skb{skbs.front()};
+                auto  len{skb.payload().size()};
+
+                if (!umem_->owns(skb.head())) {
+                        if (len > kFrameSize) {
+                                ++stats(*dev_).tx_errors;
+                                spdlog::warn("[DEV {}] WRITE FAIL FRAME {} TOO BIG", ndev_, len);
+                                skbs.pop();
+                                continue;
+                        }
+                        auto* const frame{umem_->take_frame()};
+                        if (!frame) break;
+                        auto copy{skbuff{*umem_, frame, kFrameSize, 0, kFrameSize - len}};
+                        std::ranges::copy(skb.payload(), copy.head());
+                        skb = std::move(copy);
+                }
+
+                auto const addr{umem_->addr_of(skb.head())};
+                tx.next(nframes) = {.addr = addr, .len = static_cast<uint32_t>(len), .options = 0};
+                tx_inflight_[addr / kFrameSize].emplace(std::move(skb));
+                skbs.pop();
+
+                ++nframes;
+                stats(*dev_).tx_bytes += len;
+        }
+
+        tx.submit(nframes);
+
+        // one kick for the whole batch, generic mode sends from the syscall
+        if (nframes > 0 &&
+            ::sendto(pfd_.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 &&
+            EAGAIN != errno && EBUSY != errno && ENOBUFS != errno)
+                spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_, strerror(errno));
+
+        if (!skbs.empty()) {
+                tx_blocked_ = true;
+                pfd_.async_wait(boost::asio::posix::stream_descriptor::wait_write,
+                                [this](boost::system::error_code const& ec) {
+                                        if (ec)
+                                                spdlog::warn("[DEV {}] WRITE FAIL {}", ndev_,
+                                                             ec.what());
+                                        tx_blocked_ = false;
+                                        resume_tx(*dev_);
+                                });
+        }
+
+        stats(*dev_).tx_packets += nframes;
+
+        return nframes;
+}
+
+}  // namespace mstack
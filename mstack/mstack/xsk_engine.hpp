@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "device_engine.hpp"
+#include "file_desc.hpp"
+#include "size_literals.hpp"
+#include "skbuff.hpp"
+
+namespace mstack {
+
+/**
+ *  AF_XDP socket bound to queue @queue_id of an existing interface @name. An XDP
+ *  program attached in generic (SKB) mode redirects every frame of the queue to
+ *  the socket, so the engine works on any interface, a veth included.
+ *
+ *  Frames live in the UMEM, a region shared with the kernel and split into
+ *  kFrameSize frames. Received frames are handed up the stack as skbuffs over
+ *  the UMEM frame itself, the frame goes back to the fill ring when the skbuff
+ *  dies. Frames to send are posted to the TX ring in place if they are UMEM
+ *  frames already and copied into a free one otherwise.
+ */
+class xsk_engine : public device_engine {
+public:
+        static constexpr size_t   kFrameSize{2_KiB};
+        static constexpr size_t   kFrames{4096};
+        static constexpr uint32_t kRingSize{2048};
+
+        explicit xsk_engine(boost::asio::io_context& io_ctx,
+                            std::string_view         name,
+                            uint32_t                 queue_id = 0);
+        ~xsk_engine() noexcept override;
+
+        std::string const& name() const override;
+
+        size_t mtu_max() const override;
+
+        void start(device& dev) override;
+
+        size_t transmit(std::queue<skbuff>& skbs) override;
+
+        void resume_rx() override;
+
+private:
+        class umem;
+
+        void async_receive();
+
+        void receive_batch();
+
+        void reap_completions();
+
+        std::shared_ptr<umem>                 umem_;
+        boost::asio::posix::stream_descriptor pfd_;
+        std::string                           ndev_;
+        device*                               dev_{nullptr};
+
+        file_desc xsks_map_;
+        file_desc prog_;
+        file_desc link_;
+
+        std::vector<skbuff>                in_skbs_;
+        std::vector<std::optional<skbuff>> tx_inflight_;
+        bool                               tx_blocked_{false};
+};
+
+}  // namespace mstack
@@ -0,0 +1,29 @@
+#include <cstdlib>
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+
+#include "mstack/trace.hpp"
+
+int main(int argc, char const* argv[]) {
+        if (argc < 2) {
+                std::cerr << "usage: mstack-trace <dump>\n";
+                return EXIT_FAILURE;
+        }
+
+        std::ifstream in{argv[1], std::ios::binary};
+        if (!in) {
+                std::cerr << "cannot open " << argv[1] << '\n';
+                return EXIT_FAILURE;
+        }
+
+        try {
+                mstack::trace::decode(in, std::cout);
+        } catch (std::exception const& e) {
+                std::cerr << e.what() << '\n';
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}